@@ -0,0 +1,84 @@
+#include "thread.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <iostream>
+#include <stdexcept>
+
+namespace my_coroutine_lib {
+
+// 线程信息
+static thread_local Thread* t_thread = nullptr;            // 当前线程对象，主线程为nullptr
+static thread_local std::string t_thread_name = "UNKNOWN"; // 当前线程名称
+static thread_local pid_t t_thread_id = 0;                 // 当前线程ID，首次获取时缓存，避免每次都进行系统调用
+
+pid_t Thread::GetThreadId() {
+    if(t_thread_id == 0) {
+        t_thread_id = syscall(SYS_gettid);
+    }
+    return t_thread_id;
+}
+
+Thread* Thread::GetThis() {
+    return t_thread;
+}
+
+const std::string& Thread::GetName() {
+    return t_thread_name;
+}
+
+void Thread::SetName(const std::string& name) {
+    if(t_thread) {
+        t_thread->m_name = name;
+    }
+    t_thread_name = name;
+}
+
+Thread::Thread(std::function<void()> cb, const std::string& name)
+    : m_cb(std::move(cb)), m_name(name) {
+    int rt = pthread_create(&m_thread, nullptr, &Thread::run, this);
+    if(rt) {
+        std::cerr << "pthread_create thread fail, rt = " << rt << " name = " << name << std::endl;
+        throw std::logic_error("pthread_create error");
+    }
+    // 等待线程函数完成初始化，之后getId()才有效
+    m_semaphore.wait();
+}
+
+Thread::~Thread() {
+    if(m_thread) {
+        pthread_detach(m_thread); // 没有join的线程在结束后自行回收资源
+        m_thread = 0;
+    }
+}
+
+void Thread::join() {
+    if(m_thread) {
+        int rt = pthread_join(m_thread, nullptr);
+        if(rt) {
+            std::cerr << "pthread_join failed, rt = " << rt << " name = " << m_name << std::endl;
+            throw std::logic_error("pthread_join error");
+        }
+        m_thread = 0;
+    }
+}
+
+void* Thread::run(void* arg) {
+    Thread* thread = (Thread*)arg;
+
+    t_thread = thread;
+    t_thread_name = thread->m_name;
+    thread->m_id = GetThreadId();
+    pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str()); // 内核限制线程名最长15个字符
+
+    // 取出回调后再通知构造函数返回，线程对象此后可以被析构
+    std::function<void()> cb;
+    cb.swap(thread->m_cb);
+
+    thread->m_semaphore.signal();
+
+    cb();
+    return 0;
+}
+
+}
@@ -0,0 +1,399 @@
+#include "fiber.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+
+static bool debug = false; // 是否开启调试模式
+
+namespace my_coroutine_lib {
+
+static thread_local Fiber* t_fiber = nullptr;            // 当前正在运行的协程
+static thread_local Fiber::ptr t_thread_fiber = nullptr; // 线程主协程
+static thread_local Fiber* t_scheduler_fiber = nullptr;  // 调度协程
+
+static std::atomic<uint64_t> s_fiber_id{0};    // 协程ID生成器
+static std::atomic<uint64_t> s_fiber_count{0}; // 当前存活的协程数量
+
+static const size_t g_default_stacksize = 128 * 1024; // 默认协程栈大小
+static std::atomic<size_t> s_pool_capacity{64};      // 每个线程对象池的容量
+
+static std::atomic<bool> s_stack_watermark{false};   // 是否开启栈水位统计
+static const uint8_t s_stack_fill = 0xCD;            // 栈预填充字节
+static const uint64_t s_stack_min_samples = 16;      // 自动选择栈大小前需要的样本数
+static const size_t s_stack_min_size = 16 * 1024;    // 自动选择的栈大小下限
+static const size_t s_stack_max_size = 1024 * 1024;  // 自动选择的栈大小上限
+static const size_t s_stack_margin = 4 * 1024;       // 峰值之外额外预留的安全余量
+static const size_t s_page_size = sysconf(_SC_PAGESIZE); // 保护页大小
+
+// 一个创建位置(tag)的栈使用统计，创建后不再释放
+struct StackSite {
+    std::atomic<size_t> peak{0};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<size_t> stackSize{g_default_stacksize};
+
+    void record(size_t used) {
+        size_t old_peak = peak.load(std::memory_order_relaxed);
+        while(used > old_peak && !peak.compare_exchange_weak(old_peak, used, std::memory_order_relaxed));
+        size_t cur_peak = std::max(used, old_peak);
+
+        // 样本足够后按峰值*1.5加余量向上取整到2的幂，得到有限个尺寸档位，便于对象池按栈大小复用
+        if(samples.fetch_add(1, std::memory_order_relaxed) + 1 >= s_stack_min_samples) {
+            size_t want = cur_peak + cur_peak / 2 + s_stack_margin;
+            size_t size = s_stack_min_size;
+            while(size < want && size < s_stack_max_size) {
+                size *= 2;
+            }
+            stackSize.store(size, std::memory_order_relaxed);
+        }
+    }
+};
+
+static std::mutex s_site_mutex;
+static std::unordered_map<std::string, StackSite*> s_sites;
+
+// tag是字符串常量，线程内按指针缓存，稳定状态下查找不需要加锁
+static StackSite* GetStackSite(const char* tag) {
+    static thread_local std::unordered_map<const char*, StackSite*> t_sites;
+    auto it = t_sites.find(tag);
+    if(it != t_sites.end()) {
+        return it->second;
+    }
+
+    std::lock_guard<std::mutex> lock(s_site_mutex);
+    StackSite*& site = s_sites[tag];
+    if(!site) {
+        site = new StackSite();
+    }
+    t_sites[tag] = site;
+    return site;
+}
+
+// 线程局部的协程对象池：按栈大小分桶缓存已结束的协程，取出和放回都不需要加锁
+class FiberPool {
+public:
+    ~FiberPool() {
+        t_alive = false;
+        for(auto& bucket : m_free) {
+            for(Fiber* f : bucket.second) {
+                delete f;
+            }
+        }
+    }
+
+    Fiber* take(size_t stack_size, bool guarded) {
+        auto it = m_free.find(std::make_pair(stack_size, guarded));
+        if(it == m_free.end() || it->second.empty()) {
+            return nullptr;
+        }
+        Fiber* f = it->second.back();
+        it->second.pop_back();
+        --m_size;
+        return f;
+    }
+
+    bool put(Fiber* f, size_t stack_size, bool guarded) {
+        if(m_size >= s_pool_capacity.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        m_free[std::make_pair(stack_size, guarded)].push_back(f);
+        ++m_size;
+        return true;
+    }
+
+    size_t size() const { return m_size; }
+
+    // 线程退出时对象池可能先于其它thread_local析构，之后归还的协程直接释放
+    static thread_local bool t_alive;
+
+private:
+    std::map<std::pair<size_t, bool>, std::vector<Fiber*>> m_free; // 按(栈大小, 是否带保护页)分桶
+    size_t m_size = 0;
+};
+
+thread_local bool FiberPool::t_alive = true;
+
+static thread_local FiberPool t_pool;
+
+void Fiber::SetThis(Fiber* fiber) {
+    t_fiber = fiber;
+}
+
+Fiber* Fiber::GetThis() {
+    if(t_fiber) {
+        return t_fiber;
+    }
+
+    // 首次调用时创建线程主协程，由t_thread_fiber持有
+    t_thread_fiber.reset(new Fiber());
+    t_scheduler_fiber = t_thread_fiber.get(); // 默认调度协程为主协程
+    assert(t_fiber == t_thread_fiber.get());
+    return t_fiber;
+}
+
+void Fiber::SetSchedulerFiber(Fiber* f) {
+    t_scheduler_fiber = f ? f : t_thread_fiber.get();
+}
+
+uint64_t Fiber::GetFiberId() {
+    if(t_fiber) {
+        return t_fiber->getId();
+    }
+    return (uint64_t)-1;
+}
+
+bool Fiber::InScheduledFiber() {
+    return t_fiber && t_fiber->m_runInScheduler && t_fiber != t_scheduler_fiber;
+}
+
+void Fiber::SetStackWatermark(bool enable) {
+    s_stack_watermark.store(enable, std::memory_order_relaxed);
+}
+
+bool Fiber::GetStackStats(const std::string& tag, StackStats& stats) {
+    std::lock_guard<std::mutex> lock(s_site_mutex);
+    auto it = s_sites.find(tag);
+    if(it == s_sites.end()) {
+        return false;
+    }
+    stats.peak = it->second->peak.load(std::memory_order_relaxed);
+    stats.samples = it->second->samples.load(std::memory_order_relaxed);
+    stats.stackSize = it->second->stackSize.load(std::memory_order_relaxed);
+    return true;
+}
+
+void Fiber::SetPoolCapacity(size_t capacity) {
+    s_pool_capacity.store(capacity, std::memory_order_relaxed);
+}
+
+size_t Fiber::GetPoolSize() {
+    return FiberPool::t_alive ? t_pool.size() : 0;
+}
+
+Fiber::Fiber() {
+    SetThis(this);
+    m_state.store(RUNNING, std::memory_order_relaxed);
+
+    if(getcontext(&m_ctx)) {
+        std::cerr << "Fiber() failed\n";
+        pthread_exit(NULL);
+    }
+
+    m_id = s_fiber_id++;
+    s_fiber_count++;
+    if(debug) std::cout << "Fiber(): main id = " << m_id << std::endl;
+}
+
+Fiber::Fiber(std::function<void()> cb, size_t stack_size, bool run_in_scheduler, bool guard_page)
+    : m_cb(std::move(cb)), m_runInScheduler(run_in_scheduler) {
+    m_stacksize = stack_size ? stack_size : g_default_stacksize;
+    if(guard_page) {
+        // 栈向低地址增长，保护页放在最低处；栈大小向上取整到页
+        m_stacksize = (m_stacksize + s_page_size - 1) / s_page_size * s_page_size;
+        void* base = mmap(nullptr, m_stacksize + s_page_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED || mprotect(base, s_page_size, PROT_NONE)) {
+            std::cerr << "Fiber() mmap stack failed\n";
+            pthread_exit(NULL);
+        }
+        m_stack = (char*)base + s_page_size;
+        m_stackGuarded = true;
+    }else{
+        m_stack = malloc(m_stacksize);
+    }
+    m_stackDirty = m_stacksize; // 新分配的栈内容未知
+    fillStack();
+
+    if(getcontext(&m_ctx)) {
+        std::cerr << "Fiber(std::function<void()> cb, size_t stack_size, bool run_in_scheduler) failed\n";
+        pthread_exit(NULL);
+    }
+
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = m_stack;
+    m_ctx.uc_stack.ss_size = m_stacksize;
+    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+
+    m_id = s_fiber_id++;
+    s_fiber_count++;
+    if(debug) std::cout << "Fiber(): child id = " << m_id << std::endl;
+}
+
+Fiber::~Fiber() {
+    s_fiber_count--;
+    freeStack();
+    if(debug) std::cout << "~Fiber(): id = " << m_id << std::endl;
+}
+
+Fiber::ptr Fiber::Create(std::function<void()> cb, size_t stack_size, bool run_in_scheduler, const char* tag) {
+    StackSite* site = (tag && s_stack_watermark.load(std::memory_order_relaxed)) ? GetStackSite(tag) : nullptr;
+    size_t size = stack_size ? stack_size : (site ? site->stackSize.load(std::memory_order_relaxed) : g_default_stacksize);
+    bool guarded = !stack_size && site; // 自动选择的栈可能比偶发的深调用路径小，需要保护页
+
+    Fiber* fiber = FiberPool::t_alive ? t_pool.take(size, guarded) : nullptr;
+    if(fiber) {
+        // 复用池中协程：沿用协程栈，只重建上下文并分配新的ID
+        fiber->m_runInScheduler = run_in_scheduler;
+        fiber->m_id = s_fiber_id++;
+        fiber->m_site = site;
+        fiber->reset(std::move(cb));
+        return Fiber::ptr(fiber);
+    }
+    fiber = new Fiber(std::move(cb), size, run_in_scheduler, guarded);
+    fiber->m_site = site;
+    return Fiber::ptr(fiber);
+}
+
+void Fiber::freeStack() {
+    if(!m_stack) {
+        return;
+    }
+    if(m_stackGuarded) {
+        munmap((char*)m_stack - s_page_size, m_stacksize + s_page_size);
+    }else{
+        free(m_stack);
+    }
+    m_stack = nullptr;
+}
+
+void Fiber::fillStack() {
+    if(!m_stack) {
+        return;
+    }
+    if(!s_stack_watermark.load(std::memory_order_relaxed)) {
+        m_stackDirty = m_stacksize; // 未开启统计时不填充，这次运行会把栈写脏，之后开启统计时需要整体重新填充
+        return;
+    }
+    if(m_stackDirty == 0) {
+        return;
+    }
+    // 栈向低地址增长，只有靠近栈顶的m_stackDirty字节可能被写过
+    size_t dirty = std::min(m_stackDirty, (size_t)m_stacksize);
+    memset((char*)m_stack + m_stacksize - dirty, s_stack_fill, dirty);
+    m_stackDirty = 0;
+}
+
+void Fiber::recordStackUsage() {
+    if(!m_stack || !s_stack_watermark.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if(m_stackDirty != 0) {
+        return; // 运行前没有完成填充（例如中途才开启统计），结果不可信
+    }
+
+    // 从栈底按字扫描，第一个被改写的位置即为最深处
+    const uint64_t pattern = 0x0101010101010101ull * s_stack_fill;
+    const uint64_t* p = (const uint64_t*)m_stack;
+    const uint64_t* end = (const uint64_t*)((char*)m_stack + m_stacksize);
+    while(p < end && *p == pattern) {
+        ++p;
+    }
+    m_stackPeak = (const char*)end - (const char*)p;
+
+    // 栈底的字也被改写说明栈已用尽：没有保护页时很可能已经越界改写了相邻的堆内存，无法继续运行；
+    // 有保护页时没有触发段错误说明恰好没有越界，按峰值记录后所属tag会升到更大的档位
+    if(m_stackPeak == m_stacksize) {
+        std::cerr << "Fiber id = " << m_id << " used its whole stack (" << m_stacksize << " bytes)"
+                  << (m_site ? ", tag stack size will grow" : "") << std::endl;
+        if(!m_stackGuarded) {
+            abort();
+        }
+    }
+
+    // 测量之后的yield还会使用少量栈，重新填充时多留一些余量
+    m_stackDirty = std::min(m_stackPeak + s_stack_margin, (size_t)m_stacksize);
+    if(m_site) {
+        m_site->record(m_stackPeak);
+    }
+}
+
+void Fiber::Recycle(Fiber* fiber) {
+    // 调度协程被回收后不能再作为切回的目标，否则从池中取出它的新协程会切换到自己
+    if(fiber == t_scheduler_fiber) {
+        t_scheduler_fiber = t_thread_fiber.get();
+    }
+
+    // 只有带栈且未处于挂起状态的协程可以复用，挂起的协程栈上仍有未完成的调用帧
+    State state = fiber->getState();
+    if(fiber->m_stack && (state == TERM || state == READY) && FiberPool::t_alive) {
+        fiber->m_cb = nullptr;
+        if(t_pool.put(fiber, fiber->m_stacksize, fiber->m_stackGuarded)) {
+            return;
+        }
+    }
+    delete fiber;
+}
+
+void Fiber::reset(std::function<void()> cb) {
+    State state = getState();
+    assert(m_stack != nullptr && (state == TERM || state == READY));
+
+    m_cb = std::move(cb);
+    fillStack();
+
+    if(getcontext(&m_ctx)) {
+        std::cerr << "reset() failed\n";
+        pthread_exit(NULL);
+    }
+
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = m_stack;
+    m_ctx.uc_stack.ss_size = m_stacksize;
+    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    m_state.store(READY, std::memory_order_release);
+}
+
+bool Fiber::resume() {
+    // CAS抢占执行权：READY/SUSPENDED -> RUNNING，失败说明协程正在其它线程上运行或已结束
+    State expected = getState();
+    do {
+        if(expected != READY && expected != SUSPENDED) {
+            return false;
+        }
+    } while(!m_state.compare_exchange_weak(expected, RUNNING, std::memory_order_acq_rel, std::memory_order_acquire));
+
+    SetThis(this);
+    Fiber* back = m_runInScheduler ? t_scheduler_fiber : t_thread_fiber.get();
+    if(swapcontext(&(back->m_ctx), &m_ctx)) {
+        std::cerr << "resume() failed\n";
+        pthread_exit(NULL);
+    }
+
+    // 执行到这里说明协程已经在swapcontext中完整保存了上下文，此时才允许其它线程再次恢复它
+    expected = RUNNING;
+    m_state.compare_exchange_strong(expected, SUSPENDED, std::memory_order_release, std::memory_order_relaxed);
+    return true;
+}
+
+void Fiber::yield() {
+    // 状态由resume一侧在切换完成后改为SUSPENDED，这里不修改，避免上下文尚未保存就被其它线程恢复
+    assert(getState() == RUNNING || getState() == TERM);
+
+    Fiber* back = m_runInScheduler ? t_scheduler_fiber : t_thread_fiber.get();
+    SetThis(back);
+    if(swapcontext(&m_ctx, &(back->m_ctx))) {
+        std::cerr << "yield() failed\n";
+        pthread_exit(NULL);
+    }
+}
+
+void Fiber::MainFunc() {
+    // 不持有引用：调用resume的一方在协程运行期间始终持有Fiber::ptr
+    Fiber* curr = t_fiber;
+    assert(curr != nullptr);
+
+    curr->m_cb();
+    curr->m_cb = nullptr;
+    curr->recordStackUsage();
+    curr->m_state.store(TERM, std::memory_order_release);
+
+    curr->yield();
+}
+
+}
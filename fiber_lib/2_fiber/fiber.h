@@ -5,71 +5,173 @@
 #include <memory>
 #include <atomic>
 #include <functional>
+#include <string>
 #include <cassert>
 #include <ucontext.h>
 #include <unistd.h>
-#include <mutex>
 
 namespace my_coroutine_lib {
 
-class Fiber : public std::enable_shared_from_this<Fiber> {
+// 侵入式智能指针：引用计数保存在对象内部，拷贝只需一次原子加减，不需要额外的控制块
+template<class T>
+class IntrusivePtr {
 public:
+    IntrusivePtr() = default;
+    IntrusivePtr(std::nullptr_t) {}
+    IntrusivePtr(T* p) : m_ptr(p) { if(m_ptr) m_ptr->ref(); }
+    IntrusivePtr(const IntrusivePtr& other) : m_ptr(other.m_ptr) { if(m_ptr) m_ptr->ref(); }
+    IntrusivePtr(IntrusivePtr&& other) noexcept : m_ptr(other.m_ptr) { other.m_ptr = nullptr; }
+    ~IntrusivePtr() { if(m_ptr) m_ptr->unref(); }
+
+    IntrusivePtr& operator=(const IntrusivePtr& other) {
+        IntrusivePtr(other).swap(*this);
+        return *this;
+    }
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+        IntrusivePtr(std::move(other)).swap(*this);
+        return *this;
+    }
+    IntrusivePtr& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    void reset(T* p = nullptr) { IntrusivePtr(p).swap(*this); }
+    void swap(IntrusivePtr& other) noexcept { std::swap(m_ptr, other.m_ptr); }
+
+    T* get() const { return m_ptr; }
+    T* operator->() const { return m_ptr; }
+    T& operator*() const { return *m_ptr; }
+    explicit operator bool() const { return m_ptr != nullptr; }
+
+    bool operator==(const IntrusivePtr& other) const { return m_ptr == other.m_ptr; }
+    bool operator!=(const IntrusivePtr& other) const { return m_ptr != other.m_ptr; }
+    bool operator==(std::nullptr_t) const { return m_ptr == nullptr; }
+    bool operator!=(std::nullptr_t) const { return m_ptr != nullptr; }
+
+private:
+    T* m_ptr = nullptr;
+};
+
+struct StackSite;
+
+// 协程对象由线程局部的对象池复用，引用计数归零时连同协程栈一起放回池中
+class Fiber {
+    friend class FiberPool;
+public:
+    typedef IntrusivePtr<Fiber> ptr;
+
     // 定义协程的状态
     enum State {
-        READY,      // 准备就绪
+        READY,      // 准备就绪，尚未运行
         RUNNING,    // 正在运行
+        SUSPENDED,  // 已让出执行权，可以被再次恢复
         TERM        // 结束
     };
 
 private:
     Fiber(); // 默认构造函数私有，只能被GetThis调用，用于创建主协程
+    // guard_page为true时栈用mmap分配并在栈底放一个不可访问的保护页，溢出时立即段错误而不是改写相邻内存
+    Fiber(std::function<void()> cb, size_t stack_size, bool run_in_scheduler, bool guard_page = false);
+    ~Fiber();
 
 public:
-    Fiber(std::function<void()> cb, size_t stack_size = 0, bool run_in_scheduler = true);
-    ~Fiber();
+    // 创建协程，优先从当前线程的对象池中取出栈大小相同的协程复用
+    // tag标识创建位置（需为字符串常量），开启栈水位统计后stack_size为0时按该位置观测到的栈峰值自动选择栈大小，
+    // 这类自动选择大小的栈带保护页
+    static ptr Create(std::function<void()> cb, size_t stack_size = 0, bool run_in_scheduler = true, const char* tag = nullptr);
 
     // 重用协程
     void reset(std::function<void()> cb);
 
-    // 任务线程恢复执行
-    void resume();
+    // 任务线程恢复执行，协程正在其它线程上运行或已结束时返回false
+    bool resume();
     // 任务线程让出执行权
     void yield();
 
     // 获取当前协程ID
     uint64_t getId() const { return m_id; }
     // 获取当前协程状态
-    State getState() const { return m_state; }
+    State getState() const { return m_state.load(std::memory_order_acquire); }
+
+    // 引用计数，由Fiber::ptr调用
+    void ref() { m_refCount.fetch_add(1, std::memory_order_relaxed); }
+    void unref() {
+        if(m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Recycle(this);
+        }
+    }
 
 public:
     // 设置当前协程
     static void SetThis(Fiber* fiber);
 
-    // 获取当前协程
-    static std::shared_ptr<Fiber> GetThis();
+    // 获取当前协程，不存在时创建线程主协程；返回裸指针，需要持有时再构造Fiber::ptr
+    static Fiber* GetThis();
 
-    // 设置协程调度（默认为主协程）
+    // 设置协程调度（默认为主协程），传入nullptr恢复为主协程
     static void SetSchedulerFiber(Fiber* f);
 
     // 获取当前协程id
     static uint64_t GetFiberId();
 
+    // 当前是否运行在调度器派发的任务协程中，只有这时yield后才会被重新调度
+    static bool InScheduledFiber();
+
     // 协程函数
     static void MainFunc();
 
+    // 设置每个线程对象池最多缓存的协程数量，0表示关闭对象池
+    static void SetPoolCapacity(size_t capacity);
+
+    // 当前线程对象池中缓存的协程数量
+    static size_t GetPoolSize();
+
+    // 每个tag的栈使用统计
+    struct StackStats {
+        size_t peak = 0;        // 观测到的最大栈使用量(字节)
+        uint64_t samples = 0;   // 统计过的协程数量
+        size_t stackSize = 0;   // 自动选择的栈大小，样本不足时为默认栈大小
+    };
+
+    // 开启/关闭栈水位统计：新栈预先填充固定字节，协程结束时从栈底扫描得到峰值
+    static void SetStackWatermark(bool enable);
+
+    // 获取tag的栈使用统计，没有记录返回false
+    static bool GetStackStats(const std::string& tag, StackStats& stats);
+
+    // 最近一次结束时测得的栈峰值，未开启统计时为0
+    size_t getStackPeak() const { return m_stackPeak; }
+
+private:
+    // 引用计数归零：能复用则放回对象池，否则释放
+    static void Recycle(Fiber* fiber);
+
+    // 按水位填充可能被写脏的栈区域
+    void fillStack();
+
+    // 扫描栈得到峰值并计入所属tag的统计
+    void recordStackUsage();
+
+    // 释放协程栈
+    void freeStack();
+
 private:
     uint64_t m_id = 0;                  // 协程ID
     uint32_t m_stacksize = 0;           // 协程栈大小
-    State m_state = READY;              // 协程状态
+    std::atomic<State> m_state{READY};  // 协程状态，resume通过CAS抢占，防止同一协程被重复恢复
+    std::atomic<uint32_t> m_refCount{0}; // 侵入式引用计数
     ucontext_t m_ctx;                   // 协程上下文
     void* m_stack = nullptr;            // 协程栈指针
+    bool m_stackGuarded = false;        // 栈是否由mmap分配并带保护页
     std::function<void()> m_cb;         // 协程函数
-    bool m_runInScheduler;              // 是否在调度器协程中运行
+    bool m_runInScheduler = false;      // 是否在调度器协程中运行
 
-public:
-    std::mutex m_mutex; // 协程锁，防止多线程访问冲突
-};    
+    StackSite* m_site = nullptr;        // 栈统计所属的创建位置
+    size_t m_stackPeak = 0;             // 最近一次测得的栈峰值
+    size_t m_stackDirty = 0;            // 自栈顶起可能被写脏、重用前需要重新填充的字节数
+};
 
 }
 
-#endif // _COROUTINE_H
\ No newline at end of file
+#endif // _COROUTINE_H
@@ -0,0 +1,132 @@
+#include "fork_join.h"
+
+#include <algorithm>
+
+namespace my_coroutine_lib {
+
+void WaitGroup::add(size_t n) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_count += n;
+}
+
+void WaitGroup::done() {
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_count > 0);
+        if(--m_count > 0) {
+            return;
+        }
+        waiters.swap(m_waiters);
+        m_cond.notify_all(); // 持锁通知：等待者返回后可能立即销毁WaitGroup
+    }
+
+    // 之后不再访问成员；被唤醒的协程可能还没完成yield，由resume的CAS保证不会重复恢复
+    for(auto& waiter : waiters) {
+        waiter.scheduler->scheduleLock(std::move(waiter.fiber));
+    }
+}
+
+void WaitGroup::wait() {
+    Scheduler* scheduler = Scheduler::GetThis();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_count == 0) {
+        return;
+    }
+
+    if(!scheduler || !Fiber::InScheduledFiber()) {
+        m_cond.wait(lock, [this]() { return m_count == 0; });
+        return;
+    }
+
+    // 登记后再释放锁，done()一定能看到这个等待者
+    m_waiters.push_back(Waiter{scheduler, Fiber::ptr(Fiber::GetThis())});
+    lock.unlock();
+    Fiber::GetThis()->yield();
+}
+
+void when_all(Scheduler* scheduler, std::vector<std::function<void()>> tasks, CancelToken::ptr token) {
+    auto wg = std::make_shared<WaitGroup>(tasks.size());
+    for(auto& task : tasks) {
+        scheduler->scheduleLock(std::function<void()>([wg, token, task = std::move(task)]() {
+            if(!token || !token->cancelled()) {
+                task();
+            }
+            wg->done();
+        }));
+    }
+    wg->wait();
+}
+
+int when_any(Scheduler* scheduler, std::vector<std::function<void()>> tasks, CancelToken::ptr token) {
+    if(tasks.empty()) {
+        return -1;
+    }
+    if(!token) {
+        token = std::make_shared<CancelToken>();
+    }
+
+    // 等待方返回后仍在运行的任务还会访问这些状态，由shared_ptr共同持有
+    struct State {
+        std::atomic<int> winner = -1;
+        std::atomic<size_t> remaining;  // 尚未退出的任务数量，无论是否因取消而跳过
+        WaitGroup wg{1};
+    };
+    auto state = std::make_shared<State>();
+    state->remaining = tasks.size();
+
+    for(size_t i = 0; i < tasks.size(); ++i) {
+        scheduler->scheduleLock(std::function<void()>([state, token, i, task = std::move(tasks[i])]() {
+            if(!token->cancelled()) {
+                task();
+
+                int expected = -1;
+                if(state->winner.compare_exchange_strong(expected, (int)i)) {
+                    token->cancel(); // 通知其余任务尽早退出
+                    state->wg.done();
+                }
+            }
+
+            // 最后一个退出的任务发现没有胜者(token在任何任务完成前就被取消)时放行等待方；
+            // 胜者的CAS先于它自己的计数递减，所以这里读到-1时一定不会再有胜者
+            if(--state->remaining == 0 && state->winner == -1) {
+                state->wg.done();
+            }
+        }));
+    }
+
+    state->wg.wait();
+    return state->winner;
+}
+
+bool parallel_for(Scheduler* scheduler, size_t begin, size_t end, size_t grain,
+                  std::function<void(size_t)> fn, CancelToken::ptr token) {
+    if(begin >= end) {
+        return true;
+    }
+    if(grain == 0) {
+        grain = 1;
+    }
+
+    size_t chunks = (end - begin + grain - 1) / grain;
+    auto wg = std::make_shared<WaitGroup>(chunks);
+    auto shared_fn = std::make_shared<std::function<void(size_t)>>(std::move(fn)); // 所有块共用一份fn
+
+    for(size_t lo = begin; lo < end; lo += grain) {
+        size_t hi = std::min(lo + grain, end);
+        scheduler->scheduleLock(std::function<void()>([wg, token, shared_fn, lo, hi]() {
+            for(size_t i = lo; i < hi; ++i) {
+                if(token && token->cancelled()) {
+                    break;
+                }
+                (*shared_fn)(i);
+            }
+            wg->done();
+        }));
+    }
+
+    wg->wait();
+    return !token || !token->cancelled();
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef _FORK_JOIN_H_
+#define _FORK_JOIN_H_
+
+#include "scheduler.h"
+
+#include <condition_variable>
+
+namespace my_coroutine_lib {
+
+// 取消标记：多个子任务共享，子任务在开始前和执行过程中检查，实现协作式取消
+class CancelToken {
+public:
+    typedef std::shared_ptr<CancelToken> ptr;
+
+    void cancel() { m_cancelled.store(true, std::memory_order_release); }
+    bool cancelled() const { return m_cancelled.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<bool> m_cancelled = false;
+};
+
+// 等待一组任务完成：在任务协程中wait()会让出协程而不阻塞线程，其它情况下阻塞当前线程等待
+class WaitGroup {
+public:
+    explicit WaitGroup(size_t count = 0) : m_count(count) {}
+
+    WaitGroup(const WaitGroup&) = delete;
+    WaitGroup& operator=(const WaitGroup&) = delete;
+
+    void add(size_t n = 1);
+
+    // 计数减1，归零时唤醒所有等待者
+    void done();
+
+    void wait();
+
+private:
+    struct Waiter {
+        Scheduler* scheduler; // 等待协程所在的调度器
+        Fiber::ptr fiber;     // 等待的协程
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond; // 调度器外的线程在这里等待
+    size_t m_count;
+    std::vector<Waiter> m_waiters;
+};
+
+// 把tasks分发到scheduler的工作线程上并等待全部完成；token被取消后尚未开始的任务不再执行
+void when_all(Scheduler* scheduler, std::vector<std::function<void()>> tasks, CancelToken::ptr token = nullptr);
+
+// 把tasks分发到scheduler的工作线程上，第一个任务完成后即返回它的下标
+// 返回前会取消token，其余任务应检查token尽早退出；tasks为空或token在任何任务完成前被取消时返回-1
+int when_any(Scheduler* scheduler, std::vector<std::function<void()>> tasks, CancelToken::ptr token = nullptr);
+
+// 把[begin, end)按grain切分成块分发到工作线程上，对每个下标调用fn并等待全部完成
+// token被取消后剩余的下标不再执行，此时返回false
+bool parallel_for(Scheduler* scheduler, size_t begin, size_t end, size_t grain,
+                  std::function<void(size_t)> fn, CancelToken::ptr token = nullptr);
+
+}
+
+#endif // _FORK_JOIN_H_
@@ -0,0 +1,133 @@
+#include "offload.h"
+
+#include <algorithm>
+#include <chrono>
+
+static bool debug = false; // 是否开启调试模式
+
+namespace my_coroutine_lib {
+
+static const auto s_keepAlive = std::chrono::seconds(30); // 多于min_threads的空闲线程等待这么久后退出
+
+OffloadPool::OffloadPool(size_t min_threads, size_t max_threads, size_t max_queue, const std::string& name)
+    : m_name(name), m_minThreads(min_threads), m_maxThreads(std::max(max_threads, min_threads)), m_maxQueue(max_queue) {
+    assert(m_maxThreads > 0);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(size_t i = 0; i < m_minThreads; ++i) {
+        spawnLocked();
+    }
+}
+
+OffloadPool::~OffloadPool() {
+    std::vector<std::shared_ptr<Thread>> threads;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true; // 已提交的任务仍会执行完，等待它们的协程才能被唤醒
+        threads.swap(m_threads);
+    }
+    m_cond.notify_all();
+
+    for(auto& t : threads) {
+        t->join();
+    }
+    if(debug) std::cout << "OffloadPool::~OffloadPool() success\n";
+}
+
+bool OffloadPool::submit(std::function<void()> fn, std::function<void()> done) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopping || m_tasks.size() >= m_maxQueue) {
+            return false; // 队列已满，由调用方决定重试还是向上游反压
+        }
+
+        m_tasks.push_back(Task{std::move(fn), std::move(done)});
+
+        // 没有空闲线程且未达到上限时扩容
+        if(m_idleThreads < m_tasks.size() && m_threads.size() - m_exited.size() < m_maxThreads) {
+            spawnLocked();
+        }
+    }
+    m_cond.notify_one();
+    return true;
+}
+
+bool OffloadPool::offload(std::function<void()> fn) {
+    Scheduler* scheduler = Scheduler::GetThis();
+    if(!scheduler || !Fiber::InScheduledFiber()) {
+        fn(); // 不在调度器的任务协程中，没有可以让出的协程，直接执行
+        return true;
+    }
+
+    // 持有协程的引用直到它被重新调度；完成回调可能早于yield执行，由resume的CAS保证不会重复恢复
+    Fiber::ptr self(Fiber::GetThis());
+    if(!submit(std::move(fn), [scheduler, self]() { scheduler->scheduleLock(self); })) {
+        return false;
+    }
+
+    Fiber::GetThis()->yield();
+    return true;
+}
+
+size_t OffloadPool::getThreadCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_threads.size() - m_exited.size();
+}
+
+size_t OffloadPool::getQueueSize() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_tasks.size();
+}
+
+void OffloadPool::spawnLocked() {
+    // 回收已退出的线程
+    for(pid_t id : m_exited) {
+        auto it = std::find_if(m_threads.begin(), m_threads.end(),
+            [id](const std::shared_ptr<Thread>& t) { return t->getId() == id; });
+        if(it != m_threads.end()) {
+            (*it)->join();
+            m_threads.erase(it);
+        }
+    }
+    m_exited.clear();
+
+    m_threads.push_back(std::make_shared<Thread>(
+        std::bind(&OffloadPool::run, this),
+        m_name + "_" + std::to_string(m_spawned++)));
+    if(debug) std::cout << "OffloadPool::spawnLocked() thread count: " << m_threads.size() << "\n";
+}
+
+void OffloadPool::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true) {
+        if(m_tasks.empty()) {
+            if(m_stopping) {
+                break;
+            }
+
+            ++m_idleThreads;
+            bool timeout = !m_cond.wait_for(lock, s_keepAlive, [this]() { return m_stopping || !m_tasks.empty(); });
+            --m_idleThreads;
+
+            // 空闲过久且线程数多于下限时退出，由下一次扩容时join
+            if(timeout && m_threads.size() - m_exited.size() > m_minThreads) {
+                m_exited.push_back(Thread::GetThreadId());
+                break;
+            }
+            continue;
+        }
+
+        Task task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+
+        lock.unlock();
+        task.fn();
+        if(task.done) {
+            task.done();
+        }
+        lock.lock();
+    }
+    if(debug) std::cout << "OffloadPool::run() ends in thread: " << Thread::GetThreadId() << "\n";
+}
+
+}
@@ -0,0 +1,69 @@
+#ifndef _OFFLOAD_H_
+#define _OFFLOAD_H_
+
+#include "scheduler.h"
+
+#include <condition_variable>
+#include <deque>
+#include <type_traits>
+
+namespace my_coroutine_lib {
+
+// 阻塞任务线程池：getaddrinfo、fsync、压缩等会阻塞线程的调用交给这里执行，避免卡住调度器的工作线程
+// 线程数在[min_threads, max_threads]之间按需伸缩，队列长度受max_queue限制
+class OffloadPool {
+public:
+    OffloadPool(size_t min_threads = 1, size_t max_threads = 8, size_t max_queue = 1024, const std::string& name = "Offload");
+    ~OffloadPool();
+
+    OffloadPool(const OffloadPool&) = delete;
+    OffloadPool& operator=(const OffloadPool&) = delete;
+
+    // 提交阻塞任务，done在任务执行完后于线程池线程中调用；队列已满返回false
+    bool submit(std::function<void()> fn, std::function<void()> done = nullptr);
+
+    // 在协程中调用：当前协程让出，fn在线程池中执行完毕后协程被重新放回原调度器
+    // 队列已满时返回false，fn不会被执行；不在调度器的任务协程中调用时直接在当前线程执行fn
+    bool offload(std::function<void()> fn);
+
+    // 带返回值的offload，结果写入result
+    template<class F, class R = std::invoke_result_t<F>>
+    bool offload(F fn, R* result) {
+        // 协程在fn完成前不会恢复，按引用捕获是安全的
+        return offload(std::function<void()>([&fn, result]() { *result = fn(); }));
+    }
+
+    size_t getThreadCount();
+    size_t getQueueSize();
+
+private:
+    struct Task {
+        std::function<void()> fn;   // 阻塞任务
+        std::function<void()> done; // 完成回调
+    };
+
+    // 线程池线程执行函数
+    void run();
+
+    // 在持有m_mutex时调用：清理已退出的线程并创建新线程
+    void spawnLocked();
+
+private:
+    std::string m_name;
+    size_t m_minThreads;
+    size_t m_maxThreads;
+    size_t m_maxQueue;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Task> m_tasks;                       // 等待执行的任务
+    std::vector<std::shared_ptr<Thread>> m_threads; // 线程池
+    std::vector<pid_t> m_exited;                    // 已退出、等待join的线程ID
+    size_t m_idleThreads = 0;                       // 正在等待任务的线程数量
+    size_t m_spawned = 0;                           // 创建过的线程数量，用于线程命名
+    bool m_stopping = false;
+};
+
+}
+
+#endif // _OFFLOAD_H_
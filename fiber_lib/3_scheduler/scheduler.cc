@@ -1,9 +1,39 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <ctime>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
 #include "scheduler.h"
 
 static bool debug = false; // 是否开启调试模式
 
 namespace my_coroutine_lib {
 
+static const size_t s_minSpin = 64;      // 自旋次数下限
+static const size_t s_maxSpin = 16384;   // 自旋次数上限
+static const int s_yieldRounds = 4;      // park之前sched_yield的次数
+static const long s_parkTimeoutMs = 1000; // park的最长时间，万一漏掉唤醒也能定期醒来重新检查队列
+
+// 自旋等待时提示CPU降低功耗，并让出超线程的流水线资源
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+
+// 单调时钟，纳秒
+static inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 static thread_local Scheduler* t_scheduler = nullptr; // 当前线程的调度器
 
 Scheduler* Scheduler::GetThis() {
@@ -19,15 +49,15 @@ Scheduler::Scheduler(size_t threads, bool use_scheduler, const std::string& name
         
     assert(threads > 0 && Scheduler::GetThis() == nullptr); // 确保线程数大于0且当前没有调度器
 
-    SetThis(); // 设置当前线程的调度器
-
     Thread::SetName(m_name); // 设置线程名称
 
     if(use_scheduler){
+        SetThis(); // 主线程参与调度时才设置当前线程的调度器，否则stop()中的断言会失败
+
         // 主线程本身也要参与调度任务,只需要再创建 N-1 个子线程就够了
         threads--;
         Fiber::GetThis(); // 创建主协程
-        m_schedulerFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, false)); // 创建调度器协程,false表示调度协程退出后将会返回主协程
+        m_schedulerFiber = Fiber::Create(std::bind(&Scheduler::run, this), 0, false); // 创建调度器协程,false表示调度协程退出后将会返回主协程
         Fiber::SetSchedulerFiber(m_schedulerFiber.get()); // 设置调度器协程
 
         m_rootThreadId = Thread::GetThreadId(); // 记录主线程的线程ID
@@ -45,6 +75,9 @@ Scheduler::~Scheduler() {
     if(GetThis() == this){
         t_scheduler = nullptr; // 清除当前线程的调度器
     }
+    if(m_useCaller && Thread::GetThreadId() == m_rootThreadId) {
+        Fiber::SetSchedulerFiber(nullptr); // 调度协程随调度器释放，主线程的调度协程恢复为主协程
+    }
     if(debug) {
         std::cout << "Scheduler::~Scheduler() success\n";
     }
@@ -80,8 +113,9 @@ void Scheduler::run(){
         Fiber::GetThis(); // 分配了线程的主协程和调度协程
     } 
 
-    std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this)); // 创建空闲协程
+    Fiber::ptr idle_fiber = Fiber::Create(std::bind(&Scheduler::idle, this)); // 创建空闲协程
     ScheduleTask task; // 创建任务对象
+    std::vector<Wakeup> wakeups; // 取出任务时腾出空位而被放行的提交方
 
     while(true){
         task.reset(); // 重置任务对象
@@ -93,8 +127,7 @@ void Scheduler::run(){
             // 1 遍历任务队列，查找匹配的任务
             while(it != m_tasks.end()) {
                 if(it->thread != -1 && it->thread != thread_id) {
-                    ++it; // 如果任务线程ID不匹配，则跳过该任务
-                    tickle_me = true; // 标记需要唤醒其它线程
+                    ++it; // 如果任务线程ID不匹配，则跳过该任务；目标线程已由scheduleLock的tickleThread唤醒，这里不再tickle
                     continue;
                 }
 
@@ -105,48 +138,206 @@ void Scheduler::run(){
                 m_activeThreadCount++; // 活动线程数量加1
                 break;
             }
-            if(it != m_tasks.end()){
-                tickle_me = true; // 如果找到任务，则需要唤醒其它线程
+            if(it != m_tasks.end() && it->thread == -1){
+                tickle_me = true; // 后面还有任意线程可执行的任务，唤醒其它线程
+            }
+            if(task.fiber || task.cb) {
+                onTaskTakenLocked(task, wakeups); // 可能向队列追加任务，放在迭代器使用完之后
             }
         }
         
         if(tickle_me) {
             tickle(); // 唤醒其它线程进行任务调度
         }
+        if(!wakeups.empty()) {
+            finishWakeups(wakeups); // 阻塞的提交方的任务已被代为入队，唤醒线程执行并恢复提交协程
+        }
 
         // 3 执行任务
         if(task.fiber) {
-            {
-                std::lock_guard<std::mutex> lock(task.fiber->m_mutex);
-                if(task.fiber->getState() != Fiber::TERM){
-                    task.fiber->resume(); // 恢复协程执行
-                }
+            // resume通过CAS抢占协程，失败说明协程刚被唤醒、还在其它线程上完成切换，放回队列稍后再恢复
+            if(task.fiber->getState() != Fiber::TERM && !task.fiber->resume()) {
+                scheduleLock(task.fiber, task.thread);
             }
-            m_activeThreadCount--; // 活动线程数量减1
+            taskDone();
             task.reset(); // 重置任务对象
         }else if(task.cb) {
-            std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb); // 创建普通任务协程
-            {
-                std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
-                cb_fiber->resume(); // 恢复普通任务协程执行
-            }
-            m_activeThreadCount--; // 活动线程数量减1
+            Fiber::ptr cb_fiber = Fiber::Create(std::move(task.cb), 0, true, task.tag); // 从对象池取出协程执行普通任务，栈大小按tag的统计选择
+            cb_fiber->resume(); // 恢复普通任务协程执行
+            taskDone();
             task.reset(); // 重置任务对象
         }else{              // 4 执行空闲协程
             // 系统关闭 -> idle协程将从死循环跳出并结束 -> 此时的idle协程状态为TERM -> 再次进入将跳出循环并退出run()
             if(idle_fiber->getState() == Fiber::TERM) {
-                {
-                    if(debug) {
-                        std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
-                    }
-                    break; // 如果空闲协程已经结束，则退出循环
+                if(debug) {
+                    std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
                 }
-                
-                m_idleThreadCount++;
-                idle_fiber->resume(); // 恢复空闲协程执行
-                m_idleThreadCount--; // 空闲线程数量减1
+                break; // 如果空闲协程已经结束，则退出循环
+            }
+
+            m_idleThreadCount++;
+            idle_fiber->resume(); // 恢复空闲协程执行
+            m_idleThreadCount--; // 空闲线程数量减1
+        }
+    }
+}
+
+void Scheduler::setQueueLimit(size_t max_tasks, OverflowPolicy policy) {
+    std::vector<Wakeup> wakeups;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxTasks = max_tasks;
+        m_overflowPolicy = policy;
+        grantBlockedLocked(wakeups); // 上限放宽或不再阻塞后放行等待的提交方
+    }
+    finishWakeups(wakeups);
+}
+
+void Scheduler::setQueueDelayTarget(uint64_t target_ms, uint64_t interval_ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_delayTarget = target_ms * 1000000;
+    m_delayInterval = interval_ms * 1000000;
+    m_firstAboveTime = 0;
+    m_overloaded = false;
+}
+
+bool Scheduler::admit(ScheduleTask&& task) {
+    int thread = task.thread;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // 1 过载期间直接拒绝；队列中已没有受控任务说明积压已经排空，退出过载
+        if(m_overloaded) {
+            if(m_admittedTasks > 0) {
+                ++m_rejectedCount;
+                return false;
+            }
+            m_overloaded = false;
+            m_firstAboveTime = 0;
+        }
+
+        // 2 队列已满，按策略处理；已有提交方在等待时新任务排在它们之后
+        bool full = m_maxTasks != 0 && (m_tasks.size() >= m_maxTasks || !m_blockedSubmitters.empty());
+        if(full && m_overflowPolicy == DROP_OLDEST) {
+            auto it = std::find_if(m_tasks.begin(), m_tasks.end(),
+                [](const ScheduleTask& t) { return t.admitted; });
+            if(it == m_tasks.end()) {
+                ++m_rejectedCount; // 队列里全是内部任务，它们不能丢弃
+                return false;
+            }
+            m_tasks.erase(it);
+            --m_admittedTasks;
+            ++m_droppedCount;
+        }else if(full && m_overflowPolicy == BLOCK) {
+            // 登记后等待：腾出空位时run()直接替提交方把任务入队再唤醒它，被唤醒的提交方不会再和别人争抢空位
+            BlockedSubmitter waiter;
+            waiter.task = &task;
+            Scheduler* scheduler = GetThis();
+            bool in_fiber = scheduler && Fiber::InScheduledFiber();
+            if(in_fiber) {
+                // 调度器协程（不一定属于本调度器）：挂起协程，入队后由它所属的调度器恢复
+                waiter.scheduler = scheduler;
+                waiter.fiber = Fiber::ptr(Fiber::GetThis());
+            }
+            m_blockedSubmitters.push_back(&waiter);
+
+            if(in_fiber) {
+                lock.unlock();
+                Fiber::GetThis()->yield();
+            }else{
+                m_spaceCond.wait(lock, [&waiter]() { return waiter.granted; });
+            }
+            return true;
+        }else if(full) {
+            ++m_rejectedCount;
+            return false;
+        }
+
+        // 3 入队
+        enqueueAdmittedLocked(std::move(task));
+    }
+
+    // 与scheduleLock相同，每个任务都唤醒
+    if(thread == -1) {
+        tickle();
+    }else{
+        tickleThread(thread);
+    }
+    return true;
+}
+
+void Scheduler::enqueueAdmittedLocked(ScheduleTask&& task) {
+    task.admitted = true;
+    task.enqueueTime = m_delayTarget ? now_ns() : 0;
+    m_tasks.push_back(std::move(task));
+    ++m_admittedTasks;
+}
+
+void Scheduler::grantBlockedLocked(std::vector<Wakeup>& wakeups) {
+    bool notify = false;
+    while(!m_blockedSubmitters.empty()
+        && (m_maxTasks == 0 || m_overflowPolicy != BLOCK || m_tasks.size() < m_maxTasks)) {
+        BlockedSubmitter* waiter = m_blockedSubmitters.front();
+        m_blockedSubmitters.pop_front();
+
+        int thread = waiter->task->thread;
+        enqueueAdmittedLocked(std::move(*waiter->task));
+        waiter->granted = true;
+
+        // 之后不再访问waiter：线程提交方被唤醒后立即返回，waiter随之销毁
+        if(waiter->fiber) {
+            wakeups.push_back(Wakeup{waiter->scheduler, std::move(waiter->fiber), thread});
+        }else{
+            wakeups.push_back(Wakeup{nullptr, nullptr, thread});
+            notify = true;
+        }
+    }
+    if(notify) {
+        m_spaceCond.notify_all();
+    }
+}
+
+void Scheduler::finishWakeups(std::vector<Wakeup>& wakeups) {
+    for(auto& wakeup : wakeups) {
+        if(wakeup.thread == -1) {
+            tickle();
+        }else{
+            tickleThread(wakeup.thread);
+        }
+        if(wakeup.fiber) {
+            // 协程可能还没完成yield，由resume的CAS保证不会重复恢复
+            wakeup.scheduler->scheduleLock(std::move(wakeup.fiber));
+        }
+    }
+    wakeups.clear();
+}
+
+void Scheduler::onTaskTakenLocked(const ScheduleTask& task, std::vector<Wakeup>& wakeups) {
+    if(task.admitted) {
+        --m_admittedTasks;
+
+        // CoDel：按出队时观测到的排队时延判断，短暂的突发不算过载，持续m_delayInterval都超标才算；
+        // 开启检测之前入队的任务没有入队时间，不参与判断
+        if(m_delayTarget && task.enqueueTime) {
+            uint64_t now = now_ns();
+            if(now - task.enqueueTime < m_delayTarget) {
+                m_firstAboveTime = 0;
+                m_overloaded = false;
+            }else if(m_firstAboveTime == 0) {
+                m_firstAboveTime = now + m_delayInterval;
+            }else if(now >= m_firstAboveTime) {
+                m_overloaded = true;
             }
         }
+        if(m_admittedTasks == 0) {
+            m_firstAboveTime = 0;
+            m_overloaded = false;
+        }
+    }
+
+    // 腾出的空位直接交给等待最久的提交方
+    if(!m_blockedSubmitters.empty()) {
+        grantBlockedLocked(wakeups);
     }
 }
 
@@ -166,9 +357,7 @@ void Scheduler::stop() {
         assert(GetThis() != this); // 确保当前线程的调度器不是本调度器
     }
 
-    for(size_t i = 0; i < m_threadCount; ++i) {
-        tickle(); // 唤醒所有线程进行任务调度,从而发现 m_stopping == true 后自然退出。
-    }
+    tickleAll(); // 唤醒所有线程进行任务调度,从而发现 m_stopping == true 后自然退出。
 
     // 如果主线程参与了调度，需要 resume 它的 scheduler fiber 以完成退出
     if (m_useCaller && m_schedulerFiber) {
@@ -191,16 +380,92 @@ void Scheduler::stop() {
 }
 
 void Scheduler::tickle(){
+    wakeParked(1);
+}
+
+void Scheduler::tickleAll(){
+    wakeParked(INT_MAX);
+}
+
+void Scheduler::wakeParked(int count) {
+    // 先推进序号再检查是否有线程park：与idle()中的顺序相反，两者都是seq_cst，保证不会丢失唤醒
+    m_tickleSeq.fetch_add(1);
+    if(m_parkedThreadCount.load() > 0) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_tickleSeq), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+}
 
+void Scheduler::taskDone() {
+    // 停止过程中最后一个任务完成时，park的线程不会再收到tickle，需要全部唤醒让它们退出
+    if(--m_activeThreadCount == 0 && stopping()) {
+        tickleAll();
+    }
 }
 
+bool Scheduler::hasRunnableTask(int thread_id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto& task : m_tasks) {
+        if(task.thread == -1 || task.thread == thread_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 自旋-让出-park三段式等待：先用pause指令自旋等待新任务，再让出CPU，最后在futex上休眠直到tickle()
 void Scheduler::idle(){
-	while(!stopping())
-	{
-		if(debug) std::cout << "Scheduler::idle(), sleeping in thread: " << Thread::GetThreadId() << std::endl;	
-		sleep(1);	
-		Fiber::GetThis()->yield();
-	}
+    int thread_id = Thread::GetThreadId();
+    while(!stopping()) {
+        uint32_t seq = m_tickleSeq.load();
+
+        // run()扫描队列之后、这里取序号之前入队的任务，其tickle已经计入seq，取序号后必须再查一次队列，
+        // 否则会带着这个序号park，任务要等到下一次tickle才能得到执行
+        if(hasRunnableTask(thread_id)) {
+            Fiber::GetThis()->yield();
+            continue;
+        }
+
+        size_t spin_limit = m_spinLimit.load(std::memory_order_relaxed);
+        bool woken = false;
+
+        // 1 自旋：任务到达间隔短时在这里就能接到任务，唤醒延迟在微秒级
+        for(size_t i = 0; i < spin_limit; ++i) {
+            if(m_tickleSeq.load(std::memory_order_relaxed) != seq) {
+                woken = true;
+                break;
+            }
+            cpu_relax();
+        }
+
+        // 2 让出CPU：给同核上的其它线程运行的机会
+        for(int i = 0; !woken && i < s_yieldRounds; ++i) {
+            sched_yield();
+            woken = m_tickleSeq.load(std::memory_order_relaxed) != seq;
+        }
+
+        // 根据本轮是否等到了本线程能执行的任务调整自旋时长：等到了就加倍，没等到就减半。
+        // 序号变化不一定意味着有任务给本线程（可能是别的线程抢先取走了，或是指定给其它线程的任务），
+        // 只按序号计数会让空闲线程互相把自旋时长推到上限，白白占用CPU
+        bool hit = woken && hasRunnableTask(thread_id);
+        if(hit) {
+            m_spinLimit.store(std::min(spin_limit * 2, s_maxSpin), std::memory_order_relaxed);
+        }else{
+            m_spinLimit.store(std::max(spin_limit / 2, s_minSpin), std::memory_order_relaxed);
+        }
+
+        if(!woken) {
+            // 3 park：序号仍为seq时才会休眠，期间的tickle()会令FUTEX_WAIT立即返回；超时后回到run()重新扫描队列
+            if(debug) std::cout << "Scheduler::idle(), parking in thread: " << Thread::GetThreadId() << std::endl;
+            m_parkedThreadCount.fetch_add(1);
+            if(m_tickleSeq.load() == seq && !stopping()) {
+                struct timespec timeout = {s_parkTimeoutMs / 1000, (s_parkTimeoutMs % 1000) * 1000000};
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_tickleSeq), FUTEX_WAIT_PRIVATE, seq, &timeout, nullptr, 0);
+            }
+            m_parkedThreadCount.fetch_sub(1);
+        }
+
+        Fiber::GetThis()->yield();
+    }
 }
 
 bool Scheduler::stopping() {
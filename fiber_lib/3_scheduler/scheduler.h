@@ -6,12 +6,21 @@
 
 #include <mutex>
 #include <vector>
+#include <deque>
+#include <condition_variable>
 
 namespace my_coroutine_lib {
 
 class Scheduler{
 
 public:
+    // 任务队列已满时trySchedule的处理方式
+    enum OverflowPolicy {
+        REJECT,         // 拒绝新任务，trySchedule返回false
+        BLOCK,          // 阻塞提交方直到队列有空位：调度器协程中挂起协程，其它情况下阻塞线程
+        DROP_OLDEST     // 丢弃队列中最早提交的任务，接纳新任务
+    };
+
     Scheduler(size_t threads = 1, bool use_scheduler = true, const std::string& name = "Scheduler");
     virtual ~Scheduler();
 
@@ -26,25 +35,54 @@ protected:
     void SetThis();
 
 public:
-    // 添加任务到任务队列
+    // 添加任务到任务队列，tag标识普通任务的创建位置，用于按位置统计栈使用并自动选择栈大小
     template<class FiberOrcb>
-    void scheduleLock(FiberOrcb fc, int thread = -1){
-        bool need_tickle;
+    void scheduleLock(FiberOrcb fc, int thread = -1, const char* tag = nullptr){
+        bool pushed = false;
         {
             std::lock_guard<std::mutex> lock(m_mutex);
-            need_tickle = m_tasks.empty();
-
             ScheduleTask task(fc, thread);
+            task.tag = tag;
             if(task.fiber || task.cb) {
                 m_tasks.push_back(std::move(task)); // 将任务添加到任务队列
+                pushed = true;
             }
         }
 
-        if(need_tickle) {
-            tickle(); // 唤醒调度器
+        // 每个任务都唤醒：队列非空不代表有线程会处理新任务，例如队列里只有指定给忙碌线程的任务；
+        // tickle()只在确有空闲线程时才真正唤醒，代价很小
+        if(pushed) {
+            if(thread == -1) {
+                tickle(); // 唤醒调度器
+            }else{
+                tickleThread(thread); // 唤醒指定线程
+            }
+        }
+    }
+
+    // 带准入控制的提交：队列已满或处于过载状态时按策略处理，返回false表示任务被拒绝，调用方应向上游反压
+    // 只约束通过trySchedule提交的新任务，scheduleLock提交的协程恢复、事件和定时器回调不受限制
+    template<class FiberOrcb>
+    bool trySchedule(FiberOrcb fc, int thread = -1, const char* tag = nullptr){
+        ScheduleTask task(fc, thread);
+        task.tag = tag;
+        if(!task.fiber && !task.cb) {
+            return false;
         }
+        return admit(std::move(task));
     }
 
+    // 设置任务队列上限和溢出策略，0表示不限制
+    void setQueueLimit(size_t max_tasks, OverflowPolicy policy = REJECT);
+
+    // 基于排队时延的过载保护(CoDel)：任务排队时延持续interval_ms都高于target_ms时进入过载状态，
+    // 过载期间trySchedule直接拒绝，排队时延回落到target_ms以下后恢复；target_ms为0表示关闭
+    void setQueueDelayTarget(uint64_t target_ms, uint64_t interval_ms = 100);
+
+    bool isOverloaded() const { return m_overloaded; }
+    uint64_t getRejectedCount() const { return m_rejectedCount; }  // 被拒绝的任务数量
+    uint64_t getDroppedCount() const { return m_droppedCount; }    // 被DROP_OLDEST丢弃的任务数量
+
     // 启动线程池
     virtual void start();
 
@@ -54,6 +92,12 @@ public:
 protected:
     virtual void tickle();
 
+    // 唤醒指定线程，默认退化为tickle()
+    virtual void tickleThread(int /*thread*/) { tickle(); }
+
+    // 唤醒所有空闲线程，停止时和停止过程中最后一个任务完成时调用
+    virtual void tickleAll();
+
     virtual void run();     // 线程池运行函数
 
     virtual void idle();    // 空闲时执行的函数
@@ -62,22 +106,73 @@ protected:
 
     bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
+    // 任务队列中是否有thread_id可以执行的任务；idle()在准备休眠之后再检查一次，避免丢失唤醒
+    bool hasRunnableTask(int thread_id);
+
+    // 参与调度的线程ID列表，start()之后才完整
+    const std::vector<int>& getThreadIds() const { return m_threadIds; }
+
+private:
+    // 唤醒最多count个在idle()中park的线程
+    void wakeParked(int count);
+
+    // 任务执行完毕，活动线程数量减1
+    void taskDone();
+
 private:
     struct ScheduleTask {
-        std::shared_ptr<Fiber> fiber; // 协程任务
+        Fiber::ptr fiber;             // 协程任务
         std::function<void()> cb;     // 普通任务
         int thread;               // 线程ID
+        const char* tag = nullptr; // 普通任务的创建位置
+        bool admitted = false;     // 是否经由trySchedule提交，只有这类任务受准入控制
+        uint64_t enqueueTime = 0;  // 入队时间(纳秒)，开启排队时延检测时记录
 
         ScheduleTask() : fiber(nullptr), cb(nullptr), thread(-1) {}
-        ScheduleTask(std::shared_ptr<Fiber> f, int t) : fiber(std::move(f)), thread(t) {}
+        ScheduleTask(Fiber::ptr f, int t) : fiber(std::move(f)), thread(t) {}
+        ScheduleTask(Fiber::ptr* f, int t) : thread(t) { fiber.swap(*f); } // 接管调用方持有的协程
         ScheduleTask(std::function<void()> c, int t) : cb(std::move(c)), thread(t) {}
+        ScheduleTask(std::function<void()>* c, int t) : thread(t) { cb.swap(*c); } // 接管调用方持有的回调
         void reset(){
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            tag = nullptr;
+            admitted = false;
+            enqueueTime = 0;
         }
     };
 
+    // BLOCK策略下等待空位的提交方，对象位于提交方的栈上；腾出空位时直接替它把任务入队，再唤醒它
+    struct BlockedSubmitter {
+        ScheduleTask* task = nullptr;   // 等待入队的任务
+        Scheduler* scheduler = nullptr; // 提交协程所属的调度器，nullptr表示提交方是阻塞等待的线程
+        Fiber::ptr fiber;               // 挂起的提交协程
+        bool granted = false;           // 任务是否已经入队
+    };
+
+    // 任务已代为入队、需要在释放m_mutex后处理的提交方
+    struct Wakeup {
+        Scheduler* scheduler;   // 提交协程所属的调度器，nullptr表示提交方是线程，已经通过m_spaceCond唤醒
+        Fiber::ptr fiber;
+        int thread;             // 代为入队的任务指定的线程
+    };
+
+    // trySchedule的准入控制，需要阻塞时当前协程在这里让出
+    bool admit(ScheduleTask&& task);
+
+    // 持有m_mutex时调用：把经过准入的任务放入队列
+    void enqueueAdmittedLocked(ScheduleTask&& task);
+
+    // 持有m_mutex时调用：按空位把阻塞的提交方的任务依次入队，需要在释放锁后处理的唤醒放入wakeups
+    void grantBlockedLocked(std::vector<Wakeup>& wakeups);
+
+    // 释放m_mutex后调用：唤醒代为入队的任务所在线程，并把提交协程放回它所属的调度器
+    void finishWakeups(std::vector<Wakeup>& wakeups);
+
+    // 持有m_mutex时调用：任务被取出后更新排队时延状态，并把腾出的空位交给阻塞的提交方
+    void onTaskTakenLocked(const ScheduleTask& task, std::vector<Wakeup>& wakeups);
+
 private:
     std::string m_name;                // 调度器名称
     std::mutex m_mutex;              // 互斥锁，保护任务队列
@@ -89,9 +184,25 @@ private:
     std::atomic<size_t> m_idleThreadCount = 0;   // 空闲线程数量
     
     bool m_useCaller;   // 主线程是否使用工作线程
-    std::shared_ptr<Fiber> m_schedulerFiber; // 如果是 -> 需要额外创建调度协程
+    Fiber::ptr m_schedulerFiber; // 如果是 -> 需要额外创建调度协程
     int m_rootThreadId = -1; // 如果是 -> 记录主线程的线程id
     bool m_stopping = false; // 是否正在停止调度器
+
+    std::atomic<uint32_t> m_tickleSeq = 0;          // tickle序号，同时作为park时的futex字
+    std::atomic<size_t> m_parkedThreadCount = 0;    // 在futex上休眠的线程数量
+    std::atomic<size_t> m_spinLimit = 1024;         // 当前自旋次数，随任务到达的频率自适应调整
+
+    size_t m_maxTasks = 0;                          // 任务队列上限，0表示不限制
+    OverflowPolicy m_overflowPolicy = REJECT;       // 队列已满时的处理方式
+    size_t m_admittedTasks = 0;                     // 队列中经由trySchedule提交的任务数量
+    std::deque<BlockedSubmitter*> m_blockedSubmitters; // BLOCK策略下等待空位的提交方，先到先得
+    std::condition_variable m_spaceCond;            // BLOCK策略下等待空位的线程
+    uint64_t m_delayTarget = 0;                     // 排队时延目标(纳秒)，0表示关闭过载检测
+    uint64_t m_delayInterval = 0;                   // 排队时延需持续超标多久才进入过载(纳秒)
+    uint64_t m_firstAboveTime = 0;                  // 排队时延开始超标后，预计进入过载的时间
+    std::atomic<bool> m_overloaded = false;         // 是否处于过载状态
+    std::atomic<uint64_t> m_rejectedCount = 0;
+    std::atomic<uint64_t> m_droppedCount = 0;
 };
 
 
@@ -2,6 +2,29 @@
 
 namespace my_coroutine_lib {
 
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager, uint64_t slack)
+    : m_recurring(recurring), m_ms(ms), m_slack(slack), m_cb(std::move(cb)), m_manager(manager) {
+    setDeadline(std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms)); // 计算绝对超时时间
+}
+
+void Timer::setDeadline(std::chrono::time_point<std::chrono::system_clock> earliest) {
+    m_earliest = earliest;
+    if(m_slack == 0) {
+        m_next = earliest; // 没有容差，精确触发
+        return;
+    }
+
+    // 取不超过容差的最大2的幂作为桶宽，向上对齐到桶边界：容差相近的定时器会落在同一时间点
+    uint64_t bucket = 1;
+    while(bucket * 2 <= m_slack) {
+        bucket *= 2;
+    }
+    uint64_t ms = std::chrono::ceil<std::chrono::milliseconds>(earliest.time_since_epoch()).count();
+    uint64_t aligned = (ms + bucket - 1) / bucket * bucket;
+    m_next = std::chrono::time_point<std::chrono::system_clock>(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(aligned)));
+}
+
 bool Timer::cancel(){
     std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
 
@@ -33,7 +56,7 @@ bool Timer::refresh(){
     }
 
     m_manager->m_timers.erase(it); // 从堆中删除定时器
-    m_next = std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms); // 刷新绝对超时时间
+    setDeadline(std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms)); // 刷新绝对超时时间
     m_manager->m_timers.insert(shared_from_this()); // 重新插入到堆中
     return true; // 成功刷新定时器
 }
@@ -57,9 +80,9 @@ bool Timer::reset(uint64_t ms, bool from_now){
         m_manager->m_timers.erase(it); // 从堆中删除定时器
     }
 
-    auto start = from_now ? std::chrono::system_clock::now() : m_next - std::chrono::milliseconds(m_ms); // 根据from_now决定起始时间
+    auto start = from_now ? std::chrono::system_clock::now() : m_earliest - std::chrono::milliseconds(m_ms); // 根据from_now决定起始时间
     m_ms = ms; // 更新超时时间
-    m_next = start + std::chrono::milliseconds(m_ms); // 计算新的绝对超时时间
+    setDeadline(start + std::chrono::milliseconds(m_ms)); // 计算新的绝对超时时间
     m_manager->addTimer(shared_from_this()); // 重新插入到堆中
     return true; // 成功重设定时器
 }
@@ -72,12 +95,12 @@ TimerManager::~TimerManager(){
 
 }
 
-std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
+std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring, uint64_t slack) {
     if(ms == 0 || !cb) {
         return nullptr; // 如果超时时间为0或回调函数为空，返回空指针
     }
 
-    auto timer = std::make_shared<Timer>(ms, std::move(cb), recurring, this); // 创建定时器对象
+    std::shared_ptr<Timer> timer(new Timer(ms, std::move(cb), recurring, this, slack)); // 创建定时器对象，构造函数私有无法使用make_shared
     addTimer(timer); // 添加定时器到堆中
     return timer; // 返回定时器的shared_ptr
 }
@@ -89,14 +112,17 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
     }
 }
 
-std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) {
-    return addTimer(ms, std::bind(OnTimer, weak_cond, std::move(cb)), recurring); // 添加条件定时器
+std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring, uint64_t slack) {
+    return addTimer(ms, std::bind(OnTimer, weak_cond, std::move(cb)), recurring, slack); // 添加条件定时器
 }
 
 uint64_t TimerManager::getNextTimeout() {
     std::shared_lock<std::shared_mutex> read_lock(m_mutex); // 共享锁，允许多个线程读取
     
-    m_tickled = false; // 重置tickled状态
+    // 重置tickled状态；忙轮询时每轮都会调用，已经为false时不写，避免多个线程反复写同一缓存行
+    if(m_tickled.load(std::memory_order_relaxed)) {
+        m_tickled.store(false, std::memory_order_relaxed);
+    }
 
     if(m_timers.empty()) {
         return ~0ull; // 如果没有定时器，返回最大值
@@ -122,14 +148,15 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
     bool rollover = detectClockChange(); // 检测系统时间是否出现错误
 
     // 回退->清理所有timer || 超时->清理所有超时定时器,如果rollover为false就没有发生系统时间回退
-    while(!m_timers.empty() && (rollover || (*m_timers.begin())->m_next <= now)) {
+    // 精确超时时间已到、只是被对齐推迟的定时器也在本次一起触发，省掉一次单独的唤醒
+    while(!m_timers.empty() && (rollover || (*m_timers.begin())->m_next <= now || (*m_timers.begin())->m_earliest <= now)) {
         std::shared_ptr<Timer> timer = *m_timers.begin(); // 获取最早的定时器
         m_timers.erase(m_timers.begin()); // 从堆中删除最早的
 
         cbs.push_back(std::move(timer->m_cb)); // 将定时器的回调函数添加到回调函数列表中
         // 如果定时器是循环的，则重新设置其超时时间并添加到堆中
         if(timer->m_recurring) {
-            timer->m_next = now + std::chrono::milliseconds(timer->m_ms); // 设置新的绝对超时时间
+            timer->setDeadline(now + std::chrono::milliseconds(timer->m_ms)); // 设置新的绝对超时时间
             m_timers.insert(timer); // 重新插入到堆中
         }
         else{
@@ -148,8 +175,19 @@ void TimerManager::addTimer(std::shared_ptr<Timer> timer) {
 
     {
         std::unique_lock<std::shared_mutex> write_lock(m_mutex); // 独占锁，防止其他线程修改定时器堆
+
+        // 新定时器早于当前最早的定时器，但容差允许推迟到它的触发时间：并入同一时间桶，不必唤醒reactor
+        bool coalesced = false;
+        if(!m_timers.empty()) {
+            auto front = (*m_timers.begin())->m_next;
+            if(timer->m_next < front && front <= timer->m_earliest + std::chrono::milliseconds(timer->m_slack)) {
+                timer->m_next = front;
+                coalesced = true;
+            }
+        }
+
         auto it = m_timers.insert(timer).first; // 将定时器插入到堆中，并获取迭代器
-        at_front = (it == m_timers.begin()) && !m_tickled; // 如果是最早的定时器，设置at_front为true
+        at_front = (it == m_timers.begin()) && !coalesced && !m_tickled; // 如果是最早的定时器，设置at_front为true
         if(at_front) {
             m_tickled = true; // 如果是最早的定时器，设置tickled状态为true
         }
@@ -2,12 +2,14 @@
 #define __SYLAR_TIMER_H__
 
 #include <memory>
+#include <chrono>
 #include <vector>
 #include <set>
 #include <shared_mutex>
 #include <assert.h>
 #include <functional>
 #include <mutex>
+#include <atomic>
 
 namespace my_coroutine_lib {
 class TimerManager;
@@ -25,7 +27,10 @@ public:
     bool reset(uint64_t ms, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager, uint64_t slack = 0);
+
+    // 根据精确超时时间和容差计算对齐后的触发时间
+    void setDeadline(std::chrono::time_point<std::chrono::system_clock> earliest);
 
 private:
     // 是否循环
@@ -34,7 +39,13 @@ private:
     // 超时时间
     uint64_t m_ms = 0;
 
-    // 绝对超时时间
+    // 允许延后触发的容差(ms)，0表示精确触发
+    uint64_t m_slack = 0;
+
+    // 精确超时时间，定时器不会早于该时间触发
+    std::chrono::time_point<std::chrono::system_clock> m_earliest;
+
+    // 绝对超时时间：按容差对齐到共享的时间桶，位于[m_earliest, m_earliest + m_slack]之间
     std::chrono::time_point<std::chrono::system_clock> m_next;
 
     // 超时时触发的回调函数
@@ -48,7 +59,10 @@ private:
     struct Comparator {
         bool operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const {
             assert(lhs && rhs); // 确保定时器不为空
-            return lhs->m_next < rhs->m_next; // 按照绝对超时时间排序
+            if(lhs->m_next != rhs->m_next) {
+                return lhs->m_next < rhs->m_next; // 按照绝对超时时间排序
+            }
+            return lhs.get() < rhs.get(); // 同一时间桶中的多个定时器按地址区分，避免被set去重
         }
     };
 };
@@ -59,11 +73,11 @@ public:
     TimerManager();
     virtual ~TimerManager();
 
-    // 添加定时器
-    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // 添加定时器，slack为允许延后触发的容差(ms)，容差相近的定时器会对齐到同一时间点一起触发
+    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false, uint64_t slack = 0);
 
     // 添加条件定时器
-    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false, uint64_t slack = 0);
 
     // 获取堆中最近的超时时间
     uint64_t getNextTimeout();
@@ -88,7 +102,7 @@ private:
 private:
     std::shared_mutex m_mutex; // 互斥锁，保护定时器堆
     std::set<std::shared_ptr<Timer>, Timer::Comparator> m_timers;   // 为什么不使用 std::priority_queue？因为std::priority_queue不支持迭代器，无法遍历所有定时器
-    bool m_tickled = false; // 是否有定时器被唤醒
+    std::atomic<bool> m_tickled = false; // 是否有定时器被唤醒，getNextTimeout()只持有共享锁时也会改写，所以是原子变量
     std::chrono::time_point<std::chrono::system_clock> m_lastTime; // 上次检测的系统时间
 };
 
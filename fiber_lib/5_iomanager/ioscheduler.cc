@@ -1,14 +1,21 @@
-#include <unistd.h>    
-#include <sys/epoll.h> 
-#include <fcntl.h>     
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
 #include <cstring>
+#include <cerrno>
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69 // Linux 5.11起支持，旧版本头文件中没有定义
+#endif
 
 #include "ioscheduler.h"
 
-static bool debug = true;
+static bool debug = false;
 
 namespace my_coroutine_lib {
 
+static std::atomic<uint64_t> s_iomanager_id{0}; // IOManager实例编号
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getEventContext(Event event) {
     assert(event == READ || event == WRITE); // 确保事件类型正确
     switch(event) {
@@ -25,6 +32,7 @@ void IOManager::FdContext::resetEventContext(EventContext& ctx) {
     ctx.scheduler = nullptr; // 重置事件调度器
     ctx.fiber.reset(); // 重置协程
     ctx.cb = nullptr; // 清空回调函数
+    ctx.thread = -1; // 重置执行线程
 }
 
 void IOManager::FdContext::triggerEvent(Event event) {
@@ -33,59 +41,587 @@ void IOManager::FdContext::triggerEvent(Event event) {
 
     EventContext& ctx = getEventContext(event); // 获取事件上下文
     if(ctx.cb){
-        ctx.scheduler->scheduleLock(&ctx.cb);   // 执行cb
+        ctx.scheduler->scheduleLock(&ctx.cb, ctx.thread);   // 执行cb
     }else{
-        ctx.scheduler->scheduleLock(&ctx.fiber);    // 执行协程
+        ctx.scheduler->scheduleLock(&ctx.fiber, ctx.thread);    // 执行协程
     }
 
     resetEventContext(ctx); // 重置事件上下文
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    : Scheduler(threads, use_caller, name), TimerManager() {
-    m_epfd = epoll_create(5000); // 创建epoll实例
-    assert(m_epfd > 0);
-    
-    int rt = pipe(m_tickleFds); // 成功返回0，失败返回-1
-    assert(!rt);
-    
-    epoll_event ev;
-    ev.events = EPOLLIN | EPOLLET; // 设置边缘触发模式
-    ev.data.fd = m_tickleFds[0]; // 监听读端
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name, ReactorMode mode)
+    : Scheduler(threads, use_caller, name), TimerManager(), m_id(++s_iomanager_id), m_mode(mode) {
+    // 独占模式下reactor数量等于参与调度的线程数量（含use_caller的主线程）
+    size_t count = (mode == PER_WORKER_REACTOR) ? threads : 1;
+    m_servingReactors = count;
+    for(size_t i = 0; i < count; ++i) {
+        Reactor* reactor = new Reactor();
+
+        reactor->epfd = epoll_create(5000); // 创建epoll实例
+        assert(reactor->epfd > 0);
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK); // 设置非阻塞模式
-    assert(!rt);
+        int rt = pipe(reactor->tickleFds); // 成功返回0，失败返回-1
+        assert(!rt);
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &ev); // 将读端添加到epoll中
-    assert(!rt);
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET; // 设置边缘触发模式
+        ev.data.ptr = nullptr; // 管道读端以空指针标识，其余fd存放FdContext*
 
-    contextResize(32);
+        rt = fcntl(reactor->tickleFds[0], F_SETFL, O_NONBLOCK); // 设置非阻塞模式
+        assert(!rt);
+        rt = fcntl(reactor->tickleFds[1], F_SETFL, O_NONBLOCK); // 写端也非阻塞，管道写满时tickle不会卡住
+        assert(!rt);
+
+        rt = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->tickleFds[0], &ev); // 将读端添加到epoll中
+        assert(!rt);
+
+        contextResize(reactor, 32);
+        m_reactors.push_back(reactor);
+    }
+
+    // 主线程只在stop()中才运行调度协程，分给它的fd和监听socket在此之前没人处理；
+    // 为它保留最后一个reactor供stop()期间使用，只有主线程一个调度线程时才让它承担fd
+    if(mode == PER_WORKER_REACTOR && use_caller && count > 1) {
+        m_callerReactor = m_reactors.back();
+        m_callerReactor->thread = Thread::GetThreadId();
+        m_servingReactors = count - 1;
+    }
 
     start();
 }
 
 IOManager::~IOManager(){
     stop();
-    close(m_epfd); // 关闭epoll实例
-    close(m_tickleFds[0]); // 关闭读端
-    close(m_tickleFds[1]); // 关闭写端
+    for(Reactor* reactor : m_reactors) {
+        close(reactor->epfd); // 关闭epoll实例
+        close(reactor->tickleFds[0]); // 关闭读端
+        close(reactor->tickleFds[1]); // 关闭写端
 
-    for(auto& fd_ctx : m_fdContexts) {
-        if(fd_ctx) {
-            delete fd_ctx; // 释放FdContext对象
+        for(auto& fd_ctx : reactor->fdContexts) {
+            if(fd_ctx) {
+                delete fd_ctx; // 释放FdContext对象
+            }
         }
+        delete reactor;
     }
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size); // 调整FdContext数组大小
+void IOManager::contextResize(Reactor* reactor, size_t size) {
+    reactor->fdContexts.resize(size); // 调整FdContext数组大小
     for(size_t i = 0; i < size; ++i) {
-        if(m_fdContexts[i] == nullptr){
-            m_fdContexts[i] = new FdContext();
-            m_fdContexts[i]->fd = i;
+        if(reactor->fdContexts[i] == nullptr){
+            reactor->fdContexts[i] = new FdContext();
+            reactor->fdContexts[i]->fd = i;
+        }
+    }
+}
+
+IOManager::Reactor* IOManager::localReactor() {
+    if(m_mode == SHARED_REACTOR) {
+        return m_reactors[0];
+    }
+    if(Scheduler::GetThis() != this) {
+        return nullptr; // 不是本调度器的工作线程
+    }
+
+    // 按实例编号而不是地址缓存：同一线程上先后创建的IOManager可能复用同一地址，地址相同会取到已释放的reactor
+    static thread_local uint64_t t_owner = 0;
+    static thread_local Reactor* t_reactor = nullptr;
+    if(t_owner == m_id) {
+        return t_reactor;
+    }
+
+    int thread_id = Thread::GetThreadId();
+    Reactor* found = nullptr;
+    {
+        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+        for(Reactor* reactor : m_reactors) {
+            if(reactor->thread == thread_id) {
+                found = reactor;
+                break;
+            }
+        }
+        for(size_t i = 0; !found && i < m_reactors.size(); ++i) {
+            if(m_reactors[i]->thread == -1) {
+                found = m_reactors[i];
+                found->thread = thread_id; // 认领一个尚未被使用的reactor
+            }
+        }
+    }
+    assert(found); // reactor数量与线程数量相同，每个工作线程都能认领到
+
+    t_owner = m_id;
+    t_reactor = found;
+    return found;
+}
+
+IOManager::Reactor* IOManager::bindReactor(int fd) {
+    if(m_mode == SHARED_REACTOR) {
+        return m_reactors[0];
+    }
+
+    // 非工作线程和use_caller的主线程注册的fd按fd取模分配到工作线程的reactor
+    Reactor* local = localReactor();
+    if(!local || local == m_callerReactor) {
+        local = m_reactors[fd % m_servingReactors];
+    }
+
+    int local_index = -1;
+    for(size_t i = 0; i < m_reactors.size(); ++i) {
+        if(m_reactors[i] == local) {
+            local_index = i;
+            break;
+        }
+    }
+
+    int owner_index = -1;
+    {
+        std::shared_lock<std::shared_mutex> read_lock(m_mutex);
+        if((size_t)fd < m_fdOwners.size()) {
+            owner_index = m_fdOwners[fd];
+        }
+    }
+    if(owner_index == local_index) {
+        return local;
+    }
+
+    // 锁顺序固定为fd_ctx->mutex在前、m_mutex在后，这里不能持有m_mutex去锁fd_ctx
+    std::unique_lock<std::mutex> owner_lock;
+    if(owner_index != -1) {
+        Reactor* owner = m_reactors[owner_index];
+        FdContext* fd_ctx = getFdContext(owner, fd, false);
+        if(fd_ctx) {
+            owner_lock = std::unique_lock<std::mutex>(fd_ctx->mutex);
+            // fd在其它reactor上还有未触发的事件，新事件也必须注册到同一个epoll实例
+            if(fd_ctx->events != NONE) {
+                return owner;
+            }
+        }
+    }
+
+    // 持有原reactor上fd_ctx的锁时改写归属：正在原reactor上注册事件的线程持有同一把锁，
+    // 要么先注册完（上面会看到events非空而沿用原reactor），要么在锁内重新检查归属时发现已改变
+    std::unique_lock<std::shared_mutex> write_lock(m_mutex);
+    if((size_t)fd >= m_fdOwners.size()) {
+        m_fdOwners.resize(fd * 1.5 + 1, -1);
+    }
+    if(m_fdOwners[fd] == owner_index) {
+        m_fdOwners[fd] = local_index;
+    }
+    // 期间被其它线程改绑时返回最新的归属，addEvent锁住fd_ctx后还会再确认一次
+    return m_reactors[m_fdOwners[fd]];
+}
+
+IOManager::Reactor* IOManager::reactorOf(int fd) {
+    if(m_mode == SHARED_REACTOR) {
+        return m_reactors[0];
+    }
+
+    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
+    if((size_t)fd >= m_fdOwners.size() || m_fdOwners[fd] == -1) {
+        return nullptr;
+    }
+    return m_reactors[m_fdOwners[fd]];
+}
+
+IOManager::FdContext* IOManager::getFdContext(Reactor* reactor, int fd, bool auto_create) {
+    {
+        std::shared_lock<std::shared_mutex> read_lock(reactor->mutex);
+        if((size_t)fd < reactor->fdContexts.size()) {
+            return reactor->fdContexts[fd];
         }
     }
+    if(!auto_create) {
+        return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> write_lock(reactor->mutex);
+    if((size_t)fd >= reactor->fdContexts.size()) {
+        contextResize(reactor, fd * 1.5);
+    }
+    return reactor->fdContexts[fd];
+}
+
+int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
+    Reactor* reactor = nullptr;
+    FdContext* fd_ctx = nullptr;
+    std::unique_lock<std::mutex> lock;
+    while(true) {
+        reactor = bindReactor(fd);
+        fd_ctx = getFdContext(reactor, fd, true);
+        lock = std::unique_lock<std::mutex>(fd_ctx->mutex);
+        // bindReactor返回后fd可能已被其它线程改绑，锁住fd_ctx后归属不会再变，确认无误才能注册到这个epoll
+        if(reactorOf(fd) == reactor) {
+            break;
+        }
+        lock.unlock();
+    }
+
+    // 同一个事件不能重复添加
+    if(fd_ctx->events & event) {
+        std::cerr << "addEvent assert fd = " << fd << " event = " << event << " fd_ctx.events = " << fd_ctx->events << std::endl;
+        return -1;
+    }
+
+    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    epoll_event epevent;
+    epevent.events = EPOLLET | fd_ctx->events | event;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(reactor->epfd, op, fd, &epevent);
+    if(rt) {
+        std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    ++m_pendingEventCount;
+
+    // 忙轮询模式下让socket在读取时由内核忙等网卡队列，失败（非socket或权限不足）不影响事件注册；
+    // 事件触发后会从epoll中删除，每次等待读都是EPOLL_CTL_ADD，所以按fd只设置一次，避免读路径上多两次系统调用
+    if(m_busyPoll && !fd_ctx->busyPollSet && (event & READ)) {
+        int usecs = m_busyPollUsecs;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+        setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+        fd_ctx->busyPollSet = true;
+    }
+
+    fd_ctx->events = (Event)(fd_ctx->events | event);
+
+    FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
+    assert(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
+    // 事件注册在本IOManager的epoll上，thread也是本IOManager的线程，必须回到本调度器执行；
+    // 在非工作线程（如main）上添加事件时Scheduler::GetThis()为空
+    event_ctx.scheduler = this;
+    event_ctx.thread = reactor->thread; // 独占模式下事件回到reactor所属线程执行，共享模式下为-1
+    if(cb) {
+        event_ctx.cb.swap(cb);
+    }else{
+        event_ctx.fiber = Fiber::GetThis();
+        assert(event_ctx.fiber->getState() == Fiber::RUNNING);
+    }
+    return 0;
 }
 
-}
\ No newline at end of file
+bool IOManager::delEvent(int fd, Event event) {
+    Reactor* reactor = reactorOf(fd);
+    FdContext* fd_ctx = reactor ? getFdContext(reactor, fd, false) : nullptr;
+    if(!fd_ctx) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+    if(!(fd_ctx->events & event)) {
+        return false;
+    }
+
+    Event new_events = (Event)(fd_ctx->events & ~event);
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(reactor->epfd, op, fd, &epevent);
+    if(rt) {
+        std::cerr << "delEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    --m_pendingEventCount;
+
+    fd_ctx->events = new_events;
+
+    FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
+    fd_ctx->resetEventContext(event_ctx);
+    return true;
+}
+
+bool IOManager::cancelEvent(int fd, Event event) {
+    Reactor* reactor = reactorOf(fd);
+    FdContext* fd_ctx = reactor ? getFdContext(reactor, fd, false) : nullptr;
+    if(!fd_ctx) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+    if(!(fd_ctx->events & event)) {
+        return false;
+    }
+
+    Event new_events = (Event)(fd_ctx->events & ~event);
+    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = EPOLLET | new_events;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(reactor->epfd, op, fd, &epevent);
+    if(rt) {
+        std::cerr << "cancelEvent::epoll_ctl failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    --m_pendingEventCount;
+
+    fd_ctx->triggerEvent(event); // 取消时触发一次事件，让等待的协程或回调得以继续
+    return true;
+}
+
+bool IOManager::cancelAll(int fd) {
+    Reactor* reactor = reactorOf(fd);
+    FdContext* fd_ctx = reactor ? getFdContext(reactor, fd, false) : nullptr;
+    if(!fd_ctx) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+    fd_ctx->busyPollSet = false; // fd即将关闭，号码复用后是新的socket
+
+    if(!fd_ctx->events) {
+        return false;
+    }
+
+    int op = EPOLL_CTL_DEL;
+    epoll_event epevent;
+    epevent.events = 0;
+    epevent.data.ptr = fd_ctx;
+
+    int rt = epoll_ctl(reactor->epfd, op, fd, &epevent);
+    if(rt) {
+        std::cerr << "cancelAll::epoll_ctl failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if(fd_ctx->events & READ) {
+        fd_ctx->triggerEvent(READ);
+        --m_pendingEventCount;
+    }
+
+    if(fd_ctx->events & WRITE) {
+        fd_ctx->triggerEvent(WRITE);
+        --m_pendingEventCount;
+    }
+
+    assert(fd_ctx->events == 0);
+    return true;
+}
+
+int IOManager::listenPerWorker(const sockaddr* addr, socklen_t addrlen, std::function<void(int)> accept_cb, int backlog) {
+    // 共享模式下多个监听socket落在同一个epoll实例上没有意义，只打开一个
+    size_t count = (m_mode == PER_WORKER_REACTOR) ? m_servingReactors : 1;
+    std::vector<int> thread_ids; // 工作线程，不含保留给stop()的主线程
+    for(int id : getThreadIds()) {
+        if(!m_callerReactor || id != m_callerReactor->thread) {
+            thread_ids.push_back(id);
+        }
+    }
+
+    std::vector<int> fds;
+    for(size_t i = 0; i < count; ++i) {
+        int fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int on = 1;
+        if(fd < 0
+            || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+            || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))
+            || bind(fd, addr, addrlen)
+            || listen(fd, backlog)) {
+            std::cerr << "listenPerWorker failed: " << strerror(errno) << std::endl;
+            if(fd >= 0) {
+                close(fd);
+            }
+            for(int opened : fds) {
+                close(opened);
+            }
+            return -1;
+        }
+        fds.push_back(fd);
+    }
+
+    // 每个监听socket的accept协程固定在一个工作线程上，接受的连接随之注册到该线程的reactor
+    for(size_t i = 0; i < fds.size(); ++i) {
+        int fd = fds[i];
+        int thread = (count > 1 && i < thread_ids.size()) ? thread_ids[i] : -1;
+        scheduleLock(std::function<void()>([accept_cb, fd]() { accept_cb(fd); }), thread);
+    }
+    return (int)fds.size();
+}
+
+void IOManager::wakeReactor(Reactor* reactor) {
+    int rt = write(reactor->tickleFds[1], "T", 1);
+    assert(rt == 1 || errno == EAGAIN);
+    (void)rt;
+}
+
+void IOManager::setBusyPoll(bool enable, int busy_poll_usecs) {
+    m_busyPollUsecs = busy_poll_usecs;
+    m_busyPoll = enable;
+
+    // 唤醒正阻塞在epoll_wait中的线程，让它们立即切换到新的模式
+    for(Reactor* reactor : m_reactors) {
+        wakeReactor(reactor);
+    }
+}
+
+void IOManager::tickle() {
+    // 忙轮询的线程从不阻塞，不需要唤醒
+    if(m_busyPoll) {
+        return;
+    }
+
+    // 只唤醒一个有线程即将或正在阻塞的reactor，不必惊动所有线程
+    for(Reactor* reactor : m_reactors) {
+        if(reactor->idleThreads > 0) {
+            wakeReactor(reactor);
+            return;
+        }
+    }
+}
+
+void IOManager::tickleThread(int thread) {
+    if(m_mode == SHARED_REACTOR || m_busyPoll) {
+        tickle();
+        return;
+    }
+
+    for(Reactor* reactor : m_reactors) {
+        if(reactor->thread == thread) {
+            if(reactor->idleThreads > 0) {
+                wakeReactor(reactor);
+            }
+            return;
+        }
+    }
+}
+
+void IOManager::tickleAll() {
+    // 共享模式下多个线程阻塞在同一个管道上，连续的写入可能只产生一次边缘触发，
+    // 由被唤醒的线程在退出idle()时接力唤醒下一个
+    for(Reactor* reactor : m_reactors) {
+        wakeReactor(reactor);
+    }
+}
+
+bool IOManager::stopping() {
+    return !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
+}
+
+void IOManager::idle() {
+    static const uint64_t MAX_EVENTS = 256;
+    std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVENTS]);
+
+    Reactor* reactor = localReactor();
+    assert(reactor);
+    int thread_id = Thread::GetThreadId();
+
+    while(true) {
+        if(debug) std::cout << "IOManager::idle(), run in thread: " << thread_id << std::endl;
+
+        if(stopping()) {
+            if(debug) std::cout << "name = " << getName() << " idle exits in thread: " << thread_id << std::endl;
+            wakeReactor(reactor); // 接力唤醒同一个reactor上仍在阻塞的线程
+            break;
+        }
+
+        // 阻塞在epoll_wait上，等待事件发生或定时器超时；忙轮询模式下不阻塞
+        int rt = 0;
+        bool busy_poll = m_busyPoll;
+        while(busy_poll) {
+            rt = epoll_wait(reactor->epfd, events.get(), MAX_EVENTS, 0);
+            if(rt < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        while(!busy_poll) {
+            static const uint64_t MAX_TIMEOUT = 5000;
+
+            // 先公开"即将阻塞"，再取定时器超时并最后检查一次任务队列：scheduleLock和addTimer都是先修改队列再检查idleThreads，
+            // 两边经由各自的锁排序，要么这里看到新任务或新定时器，要么对方看到本线程空闲而写管道，不会丢失唤醒
+            ++reactor->idleThreads;
+            uint64_t next_timeout = getNextTimeout();
+            next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+            if(hasRunnableTask(thread_id)) {
+                next_timeout = 0;
+            }
+
+            rt = epoll_wait(reactor->epfd, events.get(), MAX_EVENTS, (int)next_timeout);
+            --reactor->idleThreads;
+
+            if(rt < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // 收集所有超时的定时器回调；忙轮询时先用读锁检查，有到期定时器才取独占锁
+        std::vector<std::function<void()>> cbs;
+        if(!busy_poll || getNextTimeout() == 0) {
+            listExpiredCb(cbs);
+        }
+        for(auto& cb : cbs) {
+            scheduleLock(cb);
+        }
+
+        for(int i = 0; i < rt; ++i) {
+            epoll_event& event = events[i];
+
+            // tickle事件：读空管道即可
+            if(event.data.ptr == nullptr) {
+                uint8_t dummy[256];
+                while(read(reactor->tickleFds[0], dummy, sizeof(dummy)) > 0);
+                continue;
+            }
+
+            FdContext* fd_ctx = (FdContext*)event.data.ptr;
+            std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+            // 出错或挂断时同时触发已注册的读写事件
+            if(event.events & (EPOLLERR | EPOLLHUP)) {
+                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+            }
+
+            int real_events = NONE;
+            if(event.events & EPOLLIN) {
+                real_events |= READ;
+            }
+            if(event.events & EPOLLOUT) {
+                real_events |= WRITE;
+            }
+
+            if((fd_ctx->events & real_events) == NONE) {
+                continue;
+            }
+
+            // 删除已经触发的事件，剩余的事件重新注册
+            int left_events = (fd_ctx->events & ~real_events);
+            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            event.events = EPOLLET | left_events;
+
+            int rt2 = epoll_ctl(reactor->epfd, op, fd_ctx->fd, &event);
+            if(rt2) {
+                std::cerr << "idle::epoll_ctl failed: " << strerror(errno) << std::endl;
+                continue;
+            }
+
+            if(real_events & READ) {
+                fd_ctx->triggerEvent(READ);
+                --m_pendingEventCount;
+            }
+            if(real_events & WRITE) {
+                fd_ctx->triggerEvent(WRITE);
+                --m_pendingEventCount;
+            }
+        }
+
+        Fiber::GetThis()->yield();
+    }
+}
+
+void IOManager::onTimerInsertedAtFront() {
+    tickle();
+}
+
+}
@@ -4,6 +4,8 @@
 #include "3_scheduler/scheduler.h"
 #include "4_timer/timer.h"
 
+#include <sys/socket.h>
+
 namespace my_coroutine_lib {
 
 // 1 注册事件 -> 2 等待事件 -> 3 事件触发调度回调 -> 4 注销事件回调后从epoll注销 -> 5 执行回调进入调度器中执行调度
@@ -15,17 +17,24 @@ public:
         WRITE = 0x4     // EPOLLOUT
     };
 
+    enum ReactorMode {
+        SHARED_REACTOR,     // 所有工作线程共享一个epoll实例
+        PER_WORKER_REACTOR  // 每个工作线程独占一个epoll实例和fd表，fd上的事件只在注册它的线程上处理
+    };
+
 private:
     struct FdContext {
         struct EventContext {
             Scheduler *scheduler = nullptr; // 事件调度器
-            std::shared_ptr<Fiber> fiber; // 事件对应的协程
+            Fiber::ptr fiber; // 事件对应的协程
             std::function<void()> cb; // 事件对应的回调函数
+            int thread = -1; // 事件触发后在哪个线程上执行，-1表示任意线程
         };
         EventContext read;  // 读事件上下文
         EventContext write; // 写事件上下文
         int fd = 0; // 文件描述符
         Event events = NONE; // 当前事件状态
+        bool busyPollSet = false; // 是否已为该socket设置忙轮询选项，cancelAll时清除
         std::mutex mutex; // 互斥锁，保护事件上下文
 
         EventContext& getEventContext(Event event);
@@ -33,36 +42,81 @@ private:
         void triggerEvent(Event event);
     };
 
+    // 一个epoll实例及其fd表，共享模式下只有一个，独占模式下每个工作线程一个
+    struct Reactor {
+        int epfd = 0;
+        int tickleFds[2]; // fd[0] read，fd[1] write
+        std::atomic<int> thread = -1; // 所属的工作线程ID，-1表示共享或尚未被线程认领
+        std::atomic<int> idleThreads = 0; // 即将或正在阻塞在epoll_wait中的线程数量，共享模式下可能有多个
+        std::shared_mutex mutex; // 保护fd表
+        std::vector<FdContext*> fdContexts;
+    };
+
 public:
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "IOManager");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "IOManager", ReactorMode mode = SHARED_REACTOR);
 
     ~IOManager();
 
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
     bool delEvent(int fd, Event event);
     bool cancelEvent(int fd, Event event);
+    // 取消fd上的所有事件；关闭fd前应调用，fd号被新socket复用时才会重新设置忙轮询选项
     bool cancelAll(int fd);
 
+    // 为每个工作线程的reactor打开一个SO_REUSEPORT监听socket，由内核在它们之间分发连接，
+    // 并在对应的工作线程上执行accept_cb(listen_fd)；返回打开的监听socket数量，失败返回-1
+    int listenPerWorker(const sockaddr* addr, socklen_t addrlen, std::function<void(int)> accept_cb, int backlog = SOMAXCONN);
+
+    ReactorMode getReactorMode() const { return m_mode; }
+
+    // 低延迟模式：工作线程以0超时反复epoll_wait而不休眠，socket首次注册读事件时开启SO_BUSY_POLL/SO_PREFER_BUSY_POLL
+    // 只影响本IOManager，会让它的工作线程一直占满CPU
+    void setBusyPoll(bool enable, int busy_poll_usecs = 50);
+    bool isBusyPoll() const { return m_busyPoll; }
+
     static IOManager* GetThis() {
         return dynamic_cast<IOManager*>(Scheduler::GetThis());
     }
 
 protected:
     void tickle() override;
+    void tickleThread(int thread) override;
+    void tickleAll() override;
     void idle() override;
     bool stopping() override;
 
     void onTimerInsertedAtFront() override;
-    void contextResize(size_t size);
+    void contextResize(Reactor* reactor, size_t size);
+
+private:
+    // 当前线程所属的reactor，工作线程首次调用时认领一个空闲的reactor；非工作线程返回nullptr
+    Reactor* localReactor();
+
+    // addEvent时为fd选择reactor：已有事件的fd沿用原reactor，否则交给当前线程的reactor
+    Reactor* bindReactor(int fd);
+
+    // fd当前所在的reactor，不存在返回nullptr
+    Reactor* reactorOf(int fd);
+
+    // 取出fd在reactor中的上下文，fd超出fd表时按需扩容
+    FdContext* getFdContext(Reactor* reactor, int fd, bool auto_create);
+
+    // 向reactor的管道写入数据，唤醒阻塞在epoll_wait中的线程；管道已满说明已有未处理的唤醒，直接返回
+    void wakeReactor(Reactor* reactor);
 
 private:
-    int m_epfd = 0;
-    int m_tickleFds[2]; // fd[0] read，fd[1] write
+    uint64_t m_id; // 实例编号，新旧IOManager可能分配在同一地址，线程局部的reactor缓存按编号区分
+    ReactorMode m_mode;
+    std::vector<Reactor*> m_reactors;
+    size_t m_servingReactors = 1; // 可分配fd和监听socket的reactor数量，位于m_reactors前部
+    Reactor* m_callerReactor = nullptr; // 独占模式下为use_caller的主线程保留的reactor，主线程只在stop()中参与调度，不分配fd
     std::atomic<size_t> m_pendingEventCount = 0; // 待处理事件数量
-    std::shared_mutex m_mutex;
-    std::vector<FdContext*> m_fdContexts;
+    std::shared_mutex m_mutex; // 保护reactor认领和m_fdOwners
+    std::vector<int> m_fdOwners; // 独占模式下fd所在reactor的下标，-1表示没有
+    std::atomic<bool> m_busyPoll = false; // 是否忙轮询
+    std::atomic<int> m_busyPollUsecs = 50; // socket的SO_BUSY_POLL时长(微秒)
 };
 
 }
 
-#endif // __SYLAR_IOMANAGER_H__
\ No newline at end of file
+#endif // __SYLAR_IOMANAGER_H__
@@ -0,0 +1,326 @@
+// 回显压测：IOManager上的回显服务 + 开环压测，按工作线程数、连接数、消息大小扫描，输出吞吐和尾延迟
+//
+// 用法: echo_bench [--workers=1,2,4] [--conns=16,64,256] [--sizes=64,1024] [--rate=1000]
+//                  [--seconds=5] [--gen-threads=2] [--port=19500] [--idle-ms=5000]
+//                  [--per-worker] [--busy-poll] [--stack-watermark]
+//        echo_bench --check-wakeup    唤醒回归检查，不跑压测
+// 编译(在fiber_lib目录下):
+//   g++ -std=c++17 -O2 -pthread -I. 6_bench/*.cc 1_thread/thread.cc 2_fiber/fiber.cc 3_scheduler/scheduler.cc 4_timer/timer.cc 5_iomanager/ioscheduler.cc -o echo_bench
+
+#include "5_iomanager/ioscheduler.h"
+#include "load_gen.h"
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+using namespace my_coroutine_lib;
+
+struct BenchOptions {
+    std::vector<size_t> workers = {1, 2, 4};
+    std::vector<size_t> conns = {16, 64, 256};
+    std::vector<size_t> sizes = {64, 1024};
+    double rate = 1000;         // 每个连接每秒的请求数
+    double seconds = 5;
+    size_t genThreads = 2;
+    int port = 19500;
+    uint64_t idleMs = 5000;     // 连接空闲超时
+    bool perWorker = false;
+    bool busyPoll = false;
+    bool stackWatermark = false; // 栈水位统计，协程每次复用都要填充和扫描栈，默认关闭以免计入测得的延迟
+};
+
+// 回显服务的运行状态，在一次扫描点内有效
+struct EchoServer {
+    std::mutex mutex;
+    std::vector<int> listenFds;
+    std::atomic<bool> stopping = false;
+    std::atomic<int> acceptors = 0;
+    std::atomic<int> connections = 0;
+};
+
+// 把buf写完，写缓冲区满时等待可写
+static bool WriteAll(IOManager* iom, int fd, const char* buf, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if(n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if(n < 0 && errno == EAGAIN) {
+            if(iom->addEvent(fd, IOManager::WRITE)) {
+                return false;
+            }
+            Fiber::GetThis()->yield();
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+// 每个连接一个协程：读到什么写回什么，空闲超时后由定时器取消读事件并关闭连接
+static void HandleConnection(EchoServer* server, int fd, uint64_t idle_ms) {
+    IOManager* iom = IOManager::GetThis();
+    std::vector<char> buf(64 * 1024);
+
+    while(true) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if(n > 0) {
+            if(!WriteAll(iom, fd, buf.data(), n)) {
+                break;
+            }
+            continue;
+        }
+        if(n == 0 || errno != EAGAIN) {
+            break;
+        }
+
+        // 空闲超时定时器带10%的容差，大量连接的超时可以合并触发
+        auto timed_out = std::make_shared<bool>(false);
+        std::weak_ptr<bool> weak = timed_out;
+        auto timer = iom->addConditionTimer(idle_ms, [weak, iom, fd]() {
+            auto flag = weak.lock();
+            if(flag) {
+                *flag = true;
+                iom->cancelEvent(fd, IOManager::READ);
+            }
+        }, weak, false, idle_ms / 10);
+
+        if(iom->addEvent(fd, IOManager::READ)) {
+            timer->cancel();
+            break;
+        }
+        Fiber::GetThis()->yield();
+        timer->cancel();
+        if(*timed_out) {
+            break;
+        }
+    }
+
+    iom->cancelAll(fd); // 清除fd上的状态，fd号复用时重新设置忙轮询选项
+    close(fd);
+    --server->connections;
+}
+
+// 每个监听socket一个accept协程；独占reactor模式下接受的连接固定在当前线程上处理
+static void Accept(EchoServer* server, uint64_t idle_ms, int listen_fd) {
+    IOManager* iom = IOManager::GetThis();
+    int thread = (iom->getReactorMode() == IOManager::PER_WORKER_REACTOR) ? Thread::GetThreadId() : -1;
+    {
+        std::lock_guard<std::mutex> lock(server->mutex);
+        server->listenFds.push_back(listen_fd);
+    }
+
+    while(!server->stopping) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd >= 0) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            ++server->connections;
+            iom->scheduleLock(std::function<void()>([server, fd, idle_ms]() {
+                HandleConnection(server, fd, idle_ms);
+            }), thread, "echo_conn");
+            continue;
+        }
+        if(errno != EAGAIN) {
+            break;
+        }
+        if(iom->addEvent(listen_fd, IOManager::READ)) {
+            break;
+        }
+        Fiber::GetThis()->yield();
+    }
+
+    {
+        // 先从列表中移除再关闭，避免fd被复用后误取消其它连接的事件
+        std::lock_guard<std::mutex> lock(server->mutex);
+        auto& fds = server->listenFds;
+        fds.erase(std::remove(fds.begin(), fds.end(), listen_fd), fds.end());
+        close(listen_fd);
+    }
+    --server->acceptors;
+}
+
+// 唤醒回归检查：一个工作线程被指定给它的任务占住、队列里还有一个指定给它的任务时，
+// 从外部提交的普通任务应当由另一个空闲线程立即执行，而不是等到epoll_wait超时；返回等待的毫秒数
+static double CheckIdleWakeup(IOManager::ReactorMode mode) {
+    IOManager* iom = new IOManager(2, false, "check", mode);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50)); // 等两个工作线程都进入idle
+
+    std::atomic<int> busy_thread = 0;
+    std::atomic<bool> release = false;
+    iom->scheduleLock(std::function<void()>([&]() {
+        busy_thread = Thread::GetThreadId();
+        while(!release) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1)); // 阻塞线程而不是让出协程
+        }
+    }));
+    while(busy_thread == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    iom->scheduleLock(std::function<void()>([]() {}), busy_thread); // 排在忙碌线程后面的指定任务
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<bool> done = false;
+    iom->scheduleLock(std::function<void()>([&]() { done = true; }));
+    while(!done && std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    release = true;
+    while(!done) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    delete iom;
+    return waited;
+}
+
+static int RunChecks() {
+    static const double s_limitMs = 100;
+    int failed = 0;
+    for(auto mode : {IOManager::SHARED_REACTOR, IOManager::PER_WORKER_REACTOR}) {
+        double waited = CheckIdleWakeup(mode);
+        bool ok = waited < s_limitMs;
+        failed += !ok;
+        printf("idle wakeup (%s): %.2f ms %s\n",
+            mode == IOManager::SHARED_REACTOR ? "shared" : "per-worker", waited, ok ? "ok" : "FAILED");
+    }
+    return failed ? 1 : 0;
+}
+
+static std::vector<size_t> ParseList(const char* s) {
+    std::vector<size_t> values;
+    while(*s) {
+        char* end = nullptr;
+        size_t v = strtoull(s, &end, 10);
+        if(end == s) {
+            break;
+        }
+        values.push_back(v);
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return values;
+}
+
+static bool ParseArgs(int argc, char** argv, BenchOptions& opt) {
+    for(int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        const char* val = eq ? eq + 1 : "";
+        std::string key(arg, eq ? eq - arg : strlen(arg));
+
+        if(key == "--workers") opt.workers = ParseList(val);
+        else if(key == "--conns") opt.conns = ParseList(val);
+        else if(key == "--sizes") opt.sizes = ParseList(val);
+        else if(key == "--rate") opt.rate = atof(val);
+        else if(key == "--seconds") opt.seconds = atof(val);
+        else if(key == "--gen-threads") opt.genThreads = atoi(val);
+        else if(key == "--port") opt.port = atoi(val);
+        else if(key == "--idle-ms") opt.idleMs = strtoull(val, nullptr, 10);
+        else if(key == "--per-worker") opt.perWorker = true;
+        else if(key == "--busy-poll") opt.busyPoll = true;
+        else if(key == "--stack-watermark") opt.stackWatermark = true;
+        else {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return !opt.workers.empty() && !opt.conns.empty() && !opt.sizes.empty() && opt.rate > 0;
+}
+
+// 跑一个扫描点：启动服务、压测、关闭服务
+static void RunOne(const BenchOptions& opt, size_t workers, size_t conns, size_t size) {
+    EchoServer server;
+    IOManager* iom = new IOManager(workers, false, "echo",
+        opt.perWorker ? IOManager::PER_WORKER_REACTOR : IOManager::SHARED_REACTOR);
+    if(opt.busyPoll) {
+        iom->setBusyPoll(true);
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    uint64_t idle_ms = opt.idleMs;
+    EchoServer* s = &server;
+    int listeners = iom->listenPerWorker((const sockaddr*)&addr, sizeof(addr),
+        [s, idle_ms](int fd) { Accept(s, idle_ms, fd); });
+    if(listeners < 0) {
+        delete iom;
+        return;
+    }
+    server.acceptors = listeners;
+
+    LoadGenerator::Options gen;
+    gen.addr = addr;
+    gen.connections = conns;
+    gen.threads = opt.genThreads;
+    gen.messageSize = size;
+    gen.ratePerConn = opt.rate;
+    gen.seconds = opt.seconds;
+    LoadGenerator::Result r = LoadGenerator(gen).run();
+
+    // 压测端已关闭所有连接；停止accept协程后IOManager才能退出
+    server.stopping = true;
+    while(server.acceptors > 0 || server.connections > 0) {
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            for(int fd : server.listenFds) {
+                iom->cancelAll(fd);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    delete iom;
+
+    printf("%7zu %7zu %7zu %10.0f %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %7lu %6lu\n",
+        workers, conns, size,
+        conns * opt.rate, r.received / r.seconds,
+        r.latency.percentile(0.50) / 1e3, r.latency.percentile(0.90) / 1e3,
+        r.latency.percentile(0.99) / 1e3, r.latency.percentile(0.999) / 1e3,
+        r.latency.max() / 1e3,
+        (unsigned long)(r.sent - r.received), (unsigned long)r.errors);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    if(argc == 2 && strcmp(argv[1], "--check-wakeup") == 0) {
+        return RunChecks();
+    }
+
+    BenchOptions opt;
+    if(!ParseArgs(argc, argv, opt)) {
+        std::cerr << "usage: " << argv[0] << " [--workers=1,2,4] [--conns=16,64,256] [--sizes=64,1024] [--rate=1000]"
+                  << " [--seconds=5] [--gen-threads=2] [--port=19500] [--idle-ms=5000] [--per-worker] [--busy-poll] [--stack-watermark]" << std::endl;
+        return 1;
+    }
+
+    // 开启栈水位统计后，连接协程按观测到的峰值自动选择栈大小
+    Fiber::SetStackWatermark(opt.stackWatermark);
+
+    printf("# reactor=%s busy_poll=%d stack_watermark=%d rate/conn=%.0f seconds=%.1f (latency in us, measured from intended send time)\n",
+        opt.perWorker ? "per-worker" : "shared", opt.busyPoll, opt.stackWatermark, opt.rate, opt.seconds);
+    printf("%7s %7s %7s %10s %10s %9s %9s %9s %9s %9s %7s %6s\n",
+        "workers", "conns", "size", "offered", "achieved", "p50", "p90", "p99", "p99.9", "max", "lost", "errors");
+
+    for(size_t workers : opt.workers) {
+        for(size_t conns : opt.conns) {
+            for(size_t size : opt.sizes) {
+                RunOne(opt, workers, conns, size);
+            }
+        }
+    }
+    return 0;
+}
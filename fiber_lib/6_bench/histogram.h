@@ -0,0 +1,89 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace my_coroutine_lib {
+
+// HdrHistogram风格的对数-线性直方图：每个2的幂区间再均分64档，相对误差约1.6%，记录只需一次数组自增
+class LatencyHistogram {
+public:
+    LatencyHistogram() : m_counts(s_bucketCount, 0) {}
+
+    // 记录一个值(纳秒)
+    void record(uint64_t value) {
+        ++m_counts[index(value)];
+        ++m_total;
+        m_max = std::max(m_max, value);
+    }
+
+    // 合并另一个直方图，用于汇总各个压测线程的结果
+    void merge(const LatencyHistogram& other) {
+        for(size_t i = 0; i < s_bucketCount; ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    // 分位数，q取值[0, 1]，返回所在档位的中间值
+    uint64_t percentile(double q) const {
+        if(m_total == 0) {
+            return 0;
+        }
+        uint64_t target = std::max<uint64_t>(1, (uint64_t)(q * m_total + 0.5));
+        uint64_t seen = 0;
+        for(size_t i = 0; i < s_bucketCount; ++i) {
+            seen += m_counts[i];
+            if(seen >= target) {
+                return std::min(lowerBound(i) + width(i) / 2, m_max);
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t max() const { return m_max; }
+
+private:
+    static const int s_subBits = 6;                          // 每个2的幂区间的档位数为2^6
+    static const uint64_t s_sub = 1ull << s_subBits;
+    static const size_t s_bucketCount = 2 * s_sub + (63 - s_subBits) * s_sub;
+
+    // [0, 2*s_sub)逐一计数，之后每个2的幂区间s_sub档
+    static size_t index(uint64_t v) {
+        if(v < 2 * s_sub) {
+            return v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - s_subBits;
+        return 2 * s_sub + (msb - s_subBits - 1) * s_sub + ((v >> shift) - s_sub);
+    }
+
+    static uint64_t lowerBound(size_t i) {
+        if(i < 2 * s_sub) {
+            return i;
+        }
+        size_t k = i - 2 * s_sub;
+        int shift = k / s_sub + 1;
+        return (s_sub + k % s_sub) << shift;
+    }
+
+    static uint64_t width(size_t i) {
+        if(i < 2 * s_sub) {
+            return 1;
+        }
+        return 1ull << ((i - 2 * s_sub) / s_sub + 1);
+    }
+
+private:
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total = 0;
+    uint64_t m_max = 0;
+};
+
+}
+
+#endif // _HISTOGRAM_H_
@@ -0,0 +1,192 @@
+#include "load_gen.h"
+#include "1_thread/thread.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace my_coroutine_lib {
+
+static uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+LoadGenerator::Result LoadGenerator::run() {
+    size_t threads = std::max<size_t>(1, std::min(m_options.threads, m_options.connections));
+    std::vector<Result> results(threads);
+    std::vector<std::shared_ptr<Thread>> workers;
+
+    uint64_t start = NowNs();
+    for(size_t i = 0; i < threads; ++i) {
+        // 连接数不能整除时前几个线程多分一个
+        size_t count = m_options.connections / threads + (i < m_options.connections % threads ? 1 : 0);
+        workers.push_back(std::make_shared<Thread>(
+            [this, count, &results, i]() { runThread(count, results[i]); },
+            "loadgen_" + std::to_string(i)));
+    }
+    for(auto& t : workers) {
+        t->join();
+    }
+
+    Result total;
+    for(auto& r : results) {
+        total.latency.merge(r.latency);
+        total.sent += r.sent;
+        total.received += r.received;
+        total.errors += r.errors;
+    }
+    total.seconds = (NowNs() - start) / 1e9;
+    return total;
+}
+
+void LoadGenerator::runThread(size_t count, Result& result) {
+    struct Conn {
+        int fd = -1;
+        uint64_t nextSend = 0;          // 下一个请求的计划发送时间
+        size_t unsent = 0;              // 还未写出的字节数
+        size_t partial = 0;             // 已收到但不足一个响应的字节数
+        bool wantWrite = false;         // 是否在等待可写
+        bool dead = false;
+        std::deque<uint64_t> inflight;  // 已计划、未收到响应的请求的计划发送时间
+    };
+
+    static const uint64_t s_drainNs = 1000000000ull; // 发送结束后最多再等待响应的时间
+    const size_t size = m_options.messageSize;
+    const uint64_t interval = (uint64_t)(1e9 / m_options.ratePerConn);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<Conn> conns(count);
+    std::vector<char> wbuf(64 * 1024, 'x');
+    std::vector<char> rbuf(64 * 1024);
+
+    uint64_t start = NowNs();
+    for(size_t i = 0; i < count; ++i) {
+        Conn& c = conns[i];
+        c.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(c.fd < 0 || connect(c.fd, (const sockaddr*)&m_options.addr, sizeof(m_options.addr))) {
+            c.dead = true;
+            ++result.errors;
+            continue;
+        }
+        int on = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+
+        // 各连接的首个请求在一个间隔内错开，避免同时发送
+        c.nextSend = start + interval * i / std::max<size_t>(1, count);
+    }
+
+    const uint64_t send_end = start + (uint64_t)(m_options.seconds * 1e9);
+    auto close_conn = [&](Conn& c) {
+        if(!c.dead) {
+            c.dead = true;
+            ++result.errors;
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        }
+    };
+
+    std::vector<epoll_event> events(256);
+    while(true) {
+        uint64_t now = NowNs();
+
+        // 1 按计划入队请求：即使上一个响应没回来也照常发送，落后时一次补齐
+        uint64_t next_due = ~0ull;
+        bool pending = false;
+        for(Conn& c : conns) {
+            if(c.dead) {
+                continue;
+            }
+            while(c.nextSend <= now && c.nextSend < send_end) {
+                c.inflight.push_back(c.nextSend);
+                c.unsent += size;
+                c.nextSend += interval;
+                ++result.sent;
+            }
+            if(c.nextSend < send_end) {
+                next_due = std::min(next_due, c.nextSend);
+            }
+            pending = pending || !c.inflight.empty();
+
+            // 2 尽量写出积压的字节，写不完则等待可写
+            while(c.unsent > 0) {
+                ssize_t n = write(c.fd, wbuf.data(), std::min(c.unsent, wbuf.size()));
+                if(n > 0) {
+                    c.unsent -= n;
+                    continue;
+                }
+                if(n < 0 && errno == EAGAIN) {
+                    break;
+                }
+                close_conn(c);
+                break;
+            }
+            bool want_write = !c.dead && c.unsent > 0;
+            if(!c.dead && want_write != c.wantWrite) {
+                epoll_event ev;
+                ev.events = EPOLLIN | (want_write ? (uint32_t)EPOLLOUT : 0u);
+                ev.data.u64 = &c - conns.data();
+                epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+                c.wantWrite = want_write;
+            }
+        }
+
+        if(now >= send_end && (!pending || now >= send_end + s_drainNs)) {
+            break;
+        }
+
+        // 3 等待响应直到下一个计划发送时间；不足1ms时不休眠，保证按时发送
+        int timeout = 10;
+        if(next_due != ~0ull) {
+            timeout = next_due > now ? (int)((next_due - now) / 1000000) : 0;
+        }
+        int rt = epoll_wait(epfd, events.data(), events.size(), timeout);
+        now = NowNs();
+
+        // 4 按字节数切分响应，依次对应最早发出的请求
+        for(int i = 0; i < rt; ++i) {
+            Conn& c = conns[events[i].data.u64];
+            if(c.dead || !(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                continue;
+            }
+            while(true) {
+                ssize_t n = read(c.fd, rbuf.data(), rbuf.size());
+                if(n > 0) {
+                    c.partial += n;
+                    while(c.partial >= size && !c.inflight.empty()) {
+                        c.partial -= size;
+                        result.latency.record(now - c.inflight.front());
+                        c.inflight.pop_front();
+                        ++result.received;
+                    }
+                    continue;
+                }
+                if(n < 0 && errno == EAGAIN) {
+                    break;
+                }
+                close_conn(c);
+                break;
+            }
+        }
+    }
+
+    for(Conn& c : conns) {
+        if(c.fd >= 0) {
+            close(c.fd);
+        }
+    }
+    close(epfd);
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef _LOAD_GEN_H_
+#define _LOAD_GEN_H_
+
+#include "histogram.h"
+
+#include <netinet/in.h>
+#include <string>
+
+namespace my_coroutine_lib {
+
+// 开环压测：每个连接按固定间隔发送请求，不等待上一个响应；延迟从计划发送时间算起，
+// 服务端变慢时排队的时间也计入延迟，避免coordinated omission
+class LoadGenerator {
+public:
+    struct Options {
+        sockaddr_in addr{};         // 服务端地址
+        size_t connections = 16;    // 连接总数
+        size_t threads = 1;         // 压测线程数，连接均分到各线程
+        size_t messageSize = 64;    // 每个请求的字节数，服务端原样返回
+        double ratePerConn = 1000;  // 每个连接每秒的请求数
+        double seconds = 5;         // 发送时长
+    };
+
+    struct Result {
+        LatencyHistogram latency;   // 请求延迟(纳秒)
+        uint64_t sent = 0;          // 计划发送的请求数
+        uint64_t received = 0;      // 收到完整响应的请求数
+        uint64_t errors = 0;        // 连接失败或中途断开的连接数
+        double seconds = 0;         // 实际耗时
+    };
+
+    explicit LoadGenerator(const Options& options) : m_options(options) {}
+
+    // 建立连接并压测，返回汇总结果；结束后连接全部关闭
+    Result run();
+
+private:
+    // 单个压测线程，建立并驱动count个连接
+    void runThread(size_t count, Result& result);
+
+private:
+    Options m_options;
+};
+
+}
+
+#endif // _LOAD_GEN_H_